@@ -0,0 +1,286 @@
+
+//========================================================================
+//
+// Autoplayer
+//
+//========================================================================
+
+#include <ai.h>
+
+#include <algorithm>
+#include <atomic>
+#include <stdlib.h>
+
+#include <collide.h>
+
+//========================================================================
+
+int place(Board& rows, const Rotation& rot, int ix, int iy)
+{
+	int h = rot.ymax - rot.ymin + 1;
+	for (int k = 0; k < h && iy + k < NY; k++)
+		rows[iy + k] |= (RowBits) rot.rowbits[k] << ix;
+
+	// Only the rows under the piece can have become full
+	int lines = 0;
+	for (int k = h - 1; k >= 0; k--)
+	{
+		int iy0 = iy + k;
+		if (iy0 >= NY || (rows[iy0] & FULLROW) != FULLROW) continue;
+
+		for (int j = iy0; j < NY - 1; j++)
+			rows[j] = rows[j + 1];
+		rows[NY - 1] = 0;
+		lines++;
+	}
+	return lines;
+}
+
+//========================================================================
+
+double evaluate(const Board& rows, int lines, const Weights& w)
+{
+	// Sweep down from the top, tracking which columns have been covered so
+	// far.  A column's height is set by the first row that covers it, and an
+	// empty cell in a covered column is a hole
+
+	int heights[NXFULL] = {};
+	RowBits covered = 0;
+	int holes = 0;
+
+	for (int iy = NY - 1; iy >= 0; iy--)
+	{
+		RowBits row = rows[iy] & FULLROW;
+
+		holes += popcount(covered & ~row);
+
+		RowBits tops = row & ~covered;
+		while (tops)
+		{
+			heights[ctz(tops)] = iy + 1;
+			tops &= tops - 1;
+		}
+		covered |= row;
+	}
+
+	int height = 0, bumpiness = 0;
+	for (int ix = 0; ix < NXFULL; ix++)
+	{
+		height += heights[ix];
+		if (ix > 0) bumpiness += abs(heights[ix] - heights[ix - 1]);
+	}
+
+	return w.height * height + w.lines * lines + w.holes * holes
+		+ w.bumpiness * bumpiness;
+}
+
+//========================================================================
+
+Piece spawnPiece(PieceType t)
+{
+	Piece p;
+	p.t = t;
+	p.x = SPAWN_X;
+	p.y = SPAWN_Y;
+	return p;
+}
+
+//========================================================================
+
+int listPlacements(const Board& rows, const Piece& piece,
+		Placement out[MAXPLACEMENTS])
+{
+	// Find every pose that the piece can get to without going down, the same
+	// way Game::moveTo() does, and then drop them all with the batch kernel.
+	// Going down first could reach more, e.g. under an overhang, but a
+	// CMD_MOVETO can't
+	const PieceType t = piece.t;
+	Reach re;
+	reach(rows, t, piece.r, piece.x, piece.y, piece.fy != 0, re);
+
+	Cand cs[MAXPLACEMENTS];
+	int n = 0;
+	for (uint8_t r = 0; r < NROT; r++)
+	{
+		const Rotation& rot = ROTATIONS[t][r];
+
+		// Rotations that have the same shape as an earlier one, e.g. all but
+		// one for O, only add the columns that the earlier one can't reach
+		int dup = -1;
+		for (uint8_t r0 = 0; r0 < r && dup < 0; r0++)
+		{
+			const Rotation& rot0 = ROTATIONS[t][r0];
+			bool same = rot0.xmax - rot0.xmin == rot.xmax - rot.xmin
+			         && rot0.ymax - rot0.ymin == rot.ymax - rot.ymin;
+			for (int k = 0; k < NBLOCKS && same; k++)
+				same = rot0.rowbits[k] == rot.rowbits[k];
+			if (same) dup = r0;
+		}
+
+		for (int ix = 0; ix + rot.xmax - rot.xmin < NXFULL; ix++)
+		{
+			if (re.iy[r][ix] == NOREACH) continue;
+			if (dup >= 0 && re.iy[dup][ix] != NOREACH) continue;
+
+			Cand& c = cs[n++];
+			c.t = t;
+			c.r = r;
+			c.ix = ix;
+			c.iy = re.iy[r][ix];
+		}
+	}
+
+	dropBatch(WalledBoard(rows), cs, n);
+
+	for (int i = 0; i < n; i++)
+	{
+		Placement& p = out[i];
+		p.r = cs[i].r;
+		p.ix = cs[i].ix;
+		p.iy = cs[i].iy;
+	}
+	return n;
+}
+
+//========================================================================
+
+Placement bestPlacement(const Board& rows, const Piece& piece,
+		const Weights& w, int64_t* nevals)
+{
+	const PieceType t = piece.t;
+	Placement ps[MAXPLACEMENTS];
+	int n = listPlacements(rows, piece, ps);
+
+	Placement best;
+	for (int i = 0; i < n; i++)
+	{
+		Board b = rows;
+		ps[i].lines = place(b, ROTATIONS[t][ps[i].r], ps[i].ix, ps[i].iy);
+		ps[i].score = evaluate(b, ps[i].lines, w);
+
+		if (ps[i].score > best.score) best = ps[i];
+	}
+
+	if (nevals) *nevals += n;
+	return best;
+}
+
+//========================================================================
+
+double search(const Board& rows, const PieceType* pieces, int depth,
+		int beam, const Weights& w, int64_t& nevals)
+{
+	// Best score over every way to place the next depth pieces on rows.
+	// Lines are scored as they're cleared along the way, and the other
+	// features only on the final board.  Each level works on its own copy of
+	// the board, which is only NY words, so nothing needs undoing.
+	//
+	// With beam > 0, only the beam placements that look best on their own are
+	// searched any deeper.  The pieces come in a fixed order, so two paths
+	// hardly ever lead to the same board, and there's nothing to gain from
+	// remembering boards that have been searched
+
+	if (depth == 0)
+	{
+		nevals++;
+		return evaluate(rows, 0, w);
+	}
+
+	Placement ps[MAXPLACEMENTS];
+	int n = listPlacements(rows, spawnPiece(pieces[0]), ps);
+	const Rotation* rots = ROTATIONS[pieces[0]].data();
+
+	if (beam > 0 && depth > 1 && n > beam)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			Board b = rows;
+			ps[i].lines = place(b, rots[ps[i].r], ps[i].ix, ps[i].iy);
+			ps[i].score = evaluate(b, ps[i].lines, w);
+		}
+		nevals += n;
+
+		std::partial_sort(ps, ps + beam, ps + n,
+				[](const Placement& a, const Placement& b)
+				{
+					return a.score > b.score;
+				});
+		n = beam;
+	}
+
+	double best = -std::numeric_limits<double>::infinity();
+	for (int i = 0; i < n; i++)
+	{
+		Board b = rows;
+		int lines = place(b, rots[ps[i].r], ps[i].ix, ps[i].iy);
+		best = std::max(best, w.lines * lines
+				+ search(b, pieces + 1, depth - 1, beam, w, nevals));
+	}
+	return best;
+}
+
+//========================================================================
+
+Placement bestPlacement(const Board& rows, const Piece& piece,
+		const PieceType* next, int depth, int beam, const Weights& w,
+		int64_t* nevals, ThreadPool* pool)
+{
+	Placement ps[MAXPLACEMENTS];
+	int n = listPlacements(rows, piece, ps);
+
+	// Each first-level candidate writes only its own score, and the winner is
+	// picked in order afterwards, so the result doesn't depend on threads
+	std::atomic<int64_t> total{0};
+	auto f = [&](int64_t i, int)
+	{
+		Board b = rows;
+		ps[i].lines = place(b, ROTATIONS[piece.t][ps[i].r], ps[i].ix,
+				ps[i].iy);
+
+		int64_t ne = 0;
+		ps[i].score = w.lines * ps[i].lines
+				+ search(b, next, depth - 1, beam, w, ne);
+		total.fetch_add(ne, std::memory_order_relaxed);
+	};
+
+	if (pool)
+		pool->parallelFor(n, f);
+	else
+		for (int i = 0; i < n; i++)
+			f(i, 0);
+
+	Placement best;
+	for (int i = 0; i < n; i++)
+		if (ps[i].score > best.score) best = ps[i];
+
+	if (nevals) *nevals += total;
+	return best;
+}
+
+//========================================================================
+
+void Autoplayer::update(Game& game)
+{
+	if (game.over || game.ip == ip) return;
+	ip = game.ip;
+
+	Placement p;
+	if (depth <= 1)
+		p = bestPlacement(game.blocks.rows, game.piece, w, &nevals);
+	else
+		p = bestPlacement(game.blocks.rows, game.piece, game.preview.data(),
+				std::min(depth, 1 + NPREVIEW), beam, w, &nevals, pool);
+
+	// No legal placement.  Let it fall and end the game
+	if (p.score == -std::numeric_limits<double>::infinity()) return;
+
+	// The search started from where the piece is, so it can always get there,
+	// but never drop it anywhere else if it somehow doesn't
+	game.apply({CMD_MOVETO, p.r, (uint8_t) p.ix});
+	const Piece& q = game.piece;
+	bool there = q.r == p.r && q.x + q.rot().xmin == p.ix;
+	if (drop && there) game.apply({CMD_DROP});
+}
+
+//========================================================================
+
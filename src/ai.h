@@ -0,0 +1,120 @@
+
+//========================================================================
+//
+// Autoplayer:  searches every placement of the active piece, and optionally
+// of the previewed pieces after it, and scores the resulting boards with
+// a weighted sum of simple features
+//
+//========================================================================
+
+#ifndef TETRIS_AI_H
+#define TETRIS_AI_H
+
+#include <limits>
+#include <stdint.h>
+
+#include <game.h>
+#include <grid.h>
+#include <piece.h>
+#include <pool.h>
+
+//========================================================================
+
+// Feature weights.  The defaults are the well-known genetically tuned ones
+// from Yiyuan Lee's Tetris AI
+struct Weights
+{
+	double height    = -0.510066;  // sum of column heights
+	double lines     =  0.760666;  // rows cleared by the placement
+	double holes     = -0.35663;   // empty cells under the top of a column
+	double bumpiness = -0.184483;  // sum of height steps between columns
+};
+
+// A final resting place for a piece:  rotation state, and the cell of its
+// bounding box min corner
+struct Placement
+{
+	uint8_t r = 0;
+	int ix = 0, iy = 0;
+	int lines = 0;
+	double score = -std::numeric_limits<double>::infinity();
+};
+
+// Most placements that one piece can have:  every rotation in every column
+const int MAXPLACEMENTS = NROT * NXFULL;
+
+//========================================================================
+
+// Add a piece to a board and remove any rows it fills.  Returns the number of
+// rows removed
+int place(Board& rows, const Rotation& rot, int ix, int iy);
+
+// Score a board after a placement that cleared lines rows
+double evaluate(const Board& rows, int lines, const Weights& w);
+
+// A piece of type t where it would spawn.  The rotation state it spawns in is
+// random, so the lookahead takes 0 for the pieces after the active one
+Piece spawnPiece(PieceType t);
+
+// Try every rotation and column that piece can reach from where it is, by
+// moving sideways and turning and then dropping straight down, and return the
+// best.  If nevals is given, the number of placements evaluated is added to it
+Placement bestPlacement(const Board& rows, const Piece& piece,
+		const Weights& w, int64_t* nevals = nullptr);
+
+// Fill out with every distinct placement that piece can reach, like
+// bestPlacement() tries, without scoring them.  Returns the number of
+// placements
+int listPlacements(const Board& rows, const Piece& piece,
+		Placement out[MAXPLACEMENTS]);
+
+// Lookahead:  find the placement of piece that leads to the best board after
+// also placing pieces of type next[0], ..., next[depth - 2] from where they
+// spawn.  Below the first level, only the best beam candidates by their own
+// score are expanded, or all of them for beam = 0.  The first level is
+// spread over pool if given.  If nevals is given, the number of boards
+// evaluated is added to it
+Placement bestPlacement(const Board& rows, const Piece& piece,
+		const PieceType* next, int depth, int beam, const Weights& w,
+		int64_t* nevals = nullptr, ThreadPool* pool = nullptr);
+
+//========================================================================
+
+class Autoplayer
+{
+	public:
+
+		Weights w;
+
+		// Hard drop each piece after moving it into place.  Otherwise it's
+		// left to fall under gravity, which is nicer to watch
+		bool drop = true;
+
+		// Number of pieces to plan for at once:  the active piece, and then
+		// up to NPREVIEW previewed pieces.  Each level costs ~30x more
+		int depth = 1;
+
+		// Number of candidates to expand per piece below the first level, or
+		// 0 for a full search
+		int beam = 8;
+
+		// Thread pool for lookahead, or nullptr to search on the calling
+		// thread, e.g. when games are already running in parallel
+		ThreadPool* pool = nullptr;
+
+		// Number of placements evaluated so far
+		int64_t nevals = 0;
+
+		// Call once per tick.  Plans and executes a move for each new piece
+		void update(Game& game);
+
+	private:
+
+		// Index of the last piece that was planned for
+		int64_t ip = -1;
+};
+
+//========================================================================
+
+#endif
+
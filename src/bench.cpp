@@ -0,0 +1,769 @@
+
+//========================================================================
+//
+// Tetris microbenchmarks
+//
+// Run from the repo root:  ./build/tetris-bench
+//
+//========================================================================
+
+// OpenGL (only for timing the legacy transform path)
+#define GLAD_GL_IMPLEMENTATION
+#include <glad/gl.h>
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+// Standard
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+// 3P
+#include <fmt/core.h>
+
+// Tetris
+#include <ai.h>
+#include <collide.h>
+#include <game.h>
+#include <grid.h>
+#include <log.h>
+#include <piece.h>
+#include <pool.h>
+#include <rng.h>
+
+//========================================================================
+
+// Sink for benchmark results so the optimizer can't drop the work
+volatile float sink = 0;
+
+template <typename F>
+double bench(const std::string& name, int64_t n, F f, int64_t ops = 1)
+{
+	// Time n calls of f and print the cost per op in ns, where each call does
+	// ops ops
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int64_t i = 0; i < n; i++)
+		f(i);
+	auto t1 = std::chrono::steady_clock::now();
+
+	double ns = std::chrono::duration<double, std::nano>(t1 - t0).count()
+		/ (n * ops);
+	fmt::print("{:<40} {:>12.1f} ns/op\n", name, ns);
+	return ns;
+}
+
+//========================================================================
+
+void getBlockGl(PieceType t, uint8_t r, float x, float y, int i, float& bx,
+		float& by)
+{
+	// The old Piece::getBlock(), kept only as a baseline.  Requires a current
+	// GL context
+
+	glPushMatrix();
+	glLoadIdentity();
+	glTranslatef(x, y, 0.0f);
+	glRotatef(r * ROTDEG, 0.0f, 0.0f, 1.0f);
+
+	GLfloat m[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, m);
+
+	float vx = BLOCKS[t][2*i] + 0.5f, vy = BLOCKS[t][2*i+1] + 0.5f;
+	bx = m[0] * vx + m[4] * vy + m[12];
+	by = m[1] * vx + m[5] * vy + m[13];
+
+	glPopMatrix();
+}
+
+void getBlockTable(PieceType t, uint8_t r, float x, float y, int i, float& bx,
+		float& by)
+{
+	const Rotation& rot = ROTATIONS[t][r];
+	bx = x + 0.5f * rot.h[2*i+0];
+	by = y + 0.5f * rot.h[2*i+1];
+}
+
+//========================================================================
+
+void benchTransform()
+{
+	// Per-move transform cost.  One move() gets the centers of all blocks, so
+	// time NBLOCKS getBlock() calls per op
+
+	const int64_t n = 1000000;
+
+	auto move = [](auto getBlock)
+	{
+		return [getBlock](int64_t i)
+		{
+			PieceType t = static_cast<PieceType>(i % NTYPES);
+			uint8_t r = i % NROT;
+			float s = 0;
+			for (int b = 0; b < NBLOCKS; b++)
+			{
+				float bx, by;
+				getBlock(t, r, 0.5f, -0.01f * (i % 3000), b, bx, by);
+				s += bx + by;
+			}
+			sink = s;
+		};
+	};
+
+	double after = bench("transform: table lookup", n, move(getBlockTable));
+
+	// The baseline needs a GL context.  Use a hidden window
+	if (!glfwInit())
+	{
+		fmt::print("transform: no GLFW, skipping GL matrix stack baseline\n");
+		return;
+	}
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow* window = glfwCreateWindow(64, 64, "tetris-bench", NULL, NULL);
+	if (!window)
+	{
+		fmt::print("transform: no window, skipping GL matrix stack baseline\n");
+		glfwTerminate();
+		return;
+	}
+	glfwMakeContextCurrent(window);
+	gladLoadGL(glfwGetProcAddress);
+	glMatrixMode(GL_MODELVIEW);
+
+	double before = bench("transform: GL matrix stack", n / 10,
+			move(getBlockGl));
+	fmt::print("transform: speedup {:.1f}x\n", before / after);
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+}
+
+//========================================================================
+
+// Collision tolerances from the old float Piece::move()
+const double TOL = 0.05, TOL_LEDGE = 0.8;
+
+bool collidesScan(const Grid& g, PieceType t, uint8_t r, float x, float y)
+{
+	// The old Piece::move() collision check, kept as a baseline:  scan every
+	// cell against every block with double precision AABB tests
+
+	float xy[2 * NBLOCKS];
+	for (int i = 0; i < NBLOCKS; i++)
+		getBlockTable(t, r, x + ROTATIONS[t][r].sx, y, i, xy[2*i], xy[2*i+1]);
+
+	for (int ix = 0; ix < NX; ix++)
+		for (int iy = 0; iy < NY; iy++)
+		{
+			if (g.get(ix, iy) >= NTYPES) continue;
+
+			double xblo = ix + XMIN + 0 + TOL;
+			double yblo = iy + YMIN + 0 + TOL_LEDGE;
+			double xbhi = ix + XMIN + 1 - TOL;
+			double ybhi = iy + YMIN + 1 - TOL;
+
+			for (int i = 0; i < 2 * NBLOCKS; i += 2)
+			{
+				double xlo = xy[i+0] - 0.5;
+				double xhi = xy[i+0] + 0.5;
+				double ylo = xy[i+1] - 0.5;
+				double yhi = xy[i+1] + 0.5;
+
+				if (!((xhi < xblo || xlo > xbhi) || (yhi < yblo || ylo > ybhi)))
+					return true;
+			}
+		}
+	return false;
+}
+
+bool collidesBits(const Grid& g, PieceType t, uint8_t r, float x, float y)
+{
+	// The same check with the bitboard, as the float Piece::move() did it
+	// before positions were integers, kept as a second baseline.  y is
+	// continuous, so the bottom row of the bounding box may overlap any row in
+	// [iylo, iyhi], and likewise for the rows above it
+	const Rotation& rot = ROTATIONS[t][r];
+	int ix = (int) round(x + rot.xmin - XMIN);
+	double yb = y - rot.sy + rot.ymin - YMIN;
+	int iylo = (int) ceil(yb - 1 + TOL), iyhi = (int) floor(yb + 1 - TOL_LEDGE);
+
+	for (int k = 0; k <= rot.ymax - rot.ymin; k++)
+	{
+		RowBits m = rot.rowbits[k];
+		m = ix >= 0 ? m << ix : m >> -ix;
+
+		for (int iy = iylo + k; iy <= iyhi + k; iy++)
+			if (iy >= 0 && iy < NY && (m & g.rows[iy])) return true;
+	}
+	return false;
+}
+
+Piece toCells(PieceType t, uint8_t r, float x, float y)
+{
+	// The same position as a Piece, in whole cells and fixed point
+	const Rotation& rot = ROTATIONS[t][r];
+	int64_t h = llround((y - rot.sy - YMIN) * CELL);
+
+	Piece p;
+	p.t = t;
+	p.r = r;
+	p.x = (int) (x - XMIN);
+	p.y = (int) ((h + CELL - 1) / CELL);
+	p.fy = (int32_t) (p.y * CELL - h);
+	return p;
+}
+
+void benchCollision()
+{
+	// Collision checks per second against a half-full grid with a ragged top
+
+	Grid g;
+	g.clear();
+	srand(42);
+	for (int ix = 0; ix < NX - 1; ix++)
+	{
+		int h = NY / 4 + rand() % (NY / 2);
+		for (int iy = 0; iy < h; iy++)
+			if (rand() % 8) g.set(ix, iy, static_cast<PieceType>(rand() % NTYPES));
+	}
+
+	// Random piece positions, pregenerated so that rand() isn't timed
+	const int NPOS = 4096;
+	struct Pos { PieceType t; uint8_t r; float x, y; Piece cells; };
+	std::array<Pos, NPOS> pos;
+	for (auto& p: pos)
+	{
+		p.t = static_cast<PieceType>(rand() % NTYPES);
+		p.r = rand() % NROT;
+		p.x = XMIN + 2 + rand() % (NX - 5);
+		p.y = YMIN + 2 + 0.01f * (rand() % (100 * (NY - 4)));
+		p.cells = toCells(p.t, p.r, p.x, p.y);
+	}
+
+	int64_t mismatches = 0;
+	for (auto& p: pos)
+		if (collidesScan(g, p.t, p.r, p.x, p.y) != collidesBits(g, p.t, p.r, p.x, p.y))
+			mismatches++;
+	fmt::print("collision: {} mismatches out of {}\n", mismatches, NPOS);
+
+	// The exact integer check doesn't have the tolerances, so it's only
+	// timed, not compared
+	const int64_t n = 10000000;
+	double exact = bench("collision: exact integer", n, [&](int64_t i)
+	{
+		const Pos& p = pos[i % NPOS];
+		sink = !p.cells.fits(g);
+	});
+	double after = bench("collision: bitboard with tolerances", n, [&](int64_t i)
+	{
+		const Pos& p = pos[i % NPOS];
+		sink = collidesBits(g, p.t, p.r, p.x, p.y);
+	});
+	double before = bench("collision: grid scan", n / 100, [&](int64_t i)
+	{
+		const Pos& p = pos[i % NPOS];
+		sink = collidesScan(g, p.t, p.r, p.x, p.y);
+	});
+	fmt::print("collision: {:.3g} vs {:.3g} vs {:.3g} checks/s, speedup {:.1f}x and {:.1f}x\n",
+			1e9 / exact, 1e9 / after, 1e9 / before, after / exact,
+			before / exact);
+}
+
+//========================================================================
+
+std::vector<Board> randomBoards(int n)
+{
+	std::vector<Board> boards(n);
+	Rng rng(42);
+	for (auto& b: boards)
+	{
+		b.fill(0);
+		for (int ix = 0; ix < NXFULL; ix++)
+		{
+			int h = rng.below(NY / 2);
+			for (int iy = 0; iy < h; iy++)
+				if (rng.below(6)) b[iy] |= (RowBits) 1 << ix;
+		}
+	}
+	return boards;
+}
+
+//========================================================================
+
+void benchBatchCollision()
+{
+	// Candidate placements tested per second, one at a time with fits() and
+	// dropRow() and then in batches with each level of the batch kernels.
+	// The batches are every rotation of a piece in every column at the top of
+	// a ragged board, then the ones that fit dropped as far as they go, like
+	// the autoplayer drops the poses that it can reach
+
+	const int NBOARDS = 64;
+	std::vector<Board> boards = randomBoards(NBOARDS);
+	std::vector<WalledBoard> walled(boards.begin(), boards.end());
+
+	// Every rotation of every type in every column it can reach
+	std::vector<Cand> all;
+	for (int t = 0; t < NTYPES; t++)
+		for (uint8_t r = 0; r < NROT; r++)
+		{
+			const Rotation& rot = ROTATIONS[t][r];
+			for (int ix = 0; ix + rot.xmax - rot.xmin < NXFULL; ix++)
+			{
+				Cand c;
+				c.t = static_cast<PieceType>(t);
+				c.r = r;
+				c.ix = ix;
+				c.iy = NY - (rot.ymax - rot.ymin + 1);
+				all.push_back(c);
+			}
+		}
+	const int n = (int) all.size();
+
+	// Check every level against fits() and dropRow() first
+	int64_t mismatches = 0;
+	std::vector<uint8_t> fit(n);
+	for (int level = SIMD_SCALAR; level <= simdSupported(); level++)
+	{
+		simd = static_cast<SimdLevel>(level);
+		for (int i = 0; i < NBOARDS; i++)
+		{
+			std::vector<Cand> cs = all;
+			fitsBatch(walled[i], cs.data(), n, fit.data());
+			for (int j = 0; j < n; j++)
+			{
+				const Rotation& rot = ROTATIONS[cs[j].t][cs[j].r];
+				if (fit[j] != fits(boards[i], rot, cs[j].ix, cs[j].iy))
+					mismatches++;
+			}
+
+			int nfit = 0;
+			for (int j = 0; j < n; j++)
+				if (fit[j]) cs[nfit++] = cs[j];
+			std::vector<Cand> dropped(cs.begin(), cs.begin() + nfit);
+			dropBatch(walled[i], dropped.data(), nfit);
+			for (int j = 0; j < nfit; j++)
+			{
+				const Rotation& rot = ROTATIONS[cs[j].t][cs[j].r];
+				if (dropped[j].iy != dropRow(boards[i], rot, cs[j].ix, cs[j].iy))
+					mismatches++;
+			}
+		}
+	}
+	fmt::print("batch collision: {} mismatches out of {}\n", mismatches,
+			2 * NBOARDS * n * (simdSupported() + 1));
+
+	const int64_t nbatch = 100000;
+	std::vector<Cand> cs = all;
+	double one = bench("batch collision: fits() one at a time", nbatch,
+			[&](int64_t i)
+	{
+		const Board& b = boards[i % NBOARDS];
+		int nfit = 0;
+		for (const Cand& c: cs)
+			nfit += fits(b, ROTATIONS[c.t][c.r], c.ix, c.iy);
+		sink = (float) nfit;
+	}, n);
+
+	std::vector<double> ns;
+	for (int level = SIMD_SCALAR; level <= simdSupported(); level++)
+	{
+		simd = static_cast<SimdLevel>(level);
+		ns.push_back(bench(fmt::format("batch collision: fitsBatch() {}",
+				simdName(simd)), nbatch, [&](int64_t i)
+		{
+			sink = (float) fitsBatch(walled[i % NBOARDS], cs.data(), n,
+					fit.data());
+		}, n));
+	}
+	fmt::print("batch collision: {:.3g} checks/s one at a time, {:.3g} in {} batches, speedup {:.1f}x\n",
+			1e9 / one, 1e9 / ns.back(), simdName(simd), one / ns.back());
+
+	// Drops, from the top of the board to the stack, of everything that fits
+	// on the first board
+	const WalledBoard& wb = walled[0];
+	fitsBatch(wb, all.data(), n, fit.data());
+	std::vector<Cand> top;
+	for (int j = 0; j < n; j++)
+		if (fit[j]) top.push_back(all[j]);
+	const int ntop = (int) top.size();
+
+	one = bench("batch collision: dropRow() one at a time", nbatch,
+			[&](int64_t)
+	{
+		int s = 0;
+		for (const Cand& c: top)
+			s += dropRow(boards[0], ROTATIONS[c.t][c.r], c.ix, c.iy);
+		sink = (float) s;
+	}, ntop);
+
+	ns.clear();
+	for (int level = SIMD_SCALAR; level <= simdSupported(); level++)
+	{
+		simd = static_cast<SimdLevel>(level);
+		ns.push_back(bench(fmt::format("batch collision: dropBatch() {}",
+				simdName(simd)), nbatch, [&](int64_t)
+		{
+			cs = top;
+			dropBatch(wb, cs.data(), ntop);
+			sink = (float) cs[0].iy;
+		}, ntop));
+	}
+	fmt::print("batch collision: {:.3g} drops/s one at a time, {:.3g} in {} batches, speedup {:.1f}x\n",
+			1e9 / one, 1e9 / ns.back(), simdName(simd), one / ns.back());
+
+	simd = simdSupported();
+}
+
+//========================================================================
+
+void benchLanding()
+{
+	// Where a piece lands if dropped from the top, stepping down the bitboard
+	// a row at a time vs one pass over the column heights, i.e. the cost of a
+	// hard drop or of finding the ghost piece each frame
+
+	const int NBOARDS = 64;
+	std::vector<Board> boards = randomBoards(NBOARDS);
+	std::vector<Grid> grids(NBOARDS);
+	for (int i = 0; i < NBOARDS; i++)
+	{
+		grids[i].clear();
+		for (int iy = 0; iy < NY; iy++)
+			for (int ix = 0; ix < NXFULL; ix++)
+				if ((boards[i][iy] >> ix) & 1) grids[i].set(ix, iy, I);
+	}
+
+	struct Drop { const Rotation* rot; int ix, iy; };
+	std::vector<Drop> drops;
+	Rng rng(42);
+	for (int i = 0; i < 4096; i++)
+	{
+		const Rotation& rot = ROTATIONS[rng.below(NTYPES)][rng.below(NROT)];
+		drops.push_back({&rot, (int) rng.below(NXFULL - (rot.xmax - rot.xmin)),
+				NY - (rot.ymax - rot.ymin + 1)});
+	}
+
+	int64_t mismatches = 0;
+	for (int i = 0; i < NBOARDS; i++)
+		for (const Drop& d: drops)
+			if (grids[i].landRow(*d.rot, d.ix, d.iy)
+					!= dropRow(grids[i].rows, *d.rot, d.ix, d.iy))
+				mismatches++;
+	fmt::print("landing: {} mismatches out of {}\n", mismatches,
+			NBOARDS * drops.size());
+
+	const int64_t n = 10000000;
+	double before = bench("landing: dropRow() a row at a time", n, [&](int64_t i)
+	{
+		const Drop& d = drops[i % drops.size()];
+		sink = (float) dropRow(grids[i % NBOARDS].rows, *d.rot, d.ix, d.iy);
+	});
+	double after = bench("landing: landRow() from column heights", n, [&](int64_t i)
+	{
+		const Drop& d = drops[i % drops.size()];
+		sink = (float) grids[i % NBOARDS].landRow(*d.rot, d.ix, d.iy);
+	});
+	fmt::print("landing: speedup {:.1f}x\n", before / after);
+}
+
+//========================================================================
+
+void benchRotation()
+{
+	// Cost of validating a turn:  a plain collision check of the new rotation
+	// state, vs the kick table on a bare board, vs turning through the Game,
+	// which also moves the piece.  Pieces are packed into a ragged stack,
+	// where kicks are tried most
+
+	const int NBOARDS = 64;
+	std::vector<Board> boards = randomBoards(NBOARDS);
+
+	Game g;
+	g.newGame(42);
+	g.blocks.clear();
+	for (int iy = 0; iy < NY; iy++)
+		for (int ix = 0; ix < NXFULL; ix++)
+			if ((boards[0][iy] >> ix) & 1) g.blocks.set(ix, iy, I);
+
+	// Random pieces that fit on the first board, on a whole row, resting on
+	// the stack half the time
+	std::vector<Piece> ps;
+	Rng rng(42);
+	while (ps.size() < 4096)
+	{
+		Piece p;
+		p.t = static_cast<PieceType>(rng.below(NTYPES));
+		p.r = rng.below(NROT);
+		p.x = rng.below(NXFULL);
+		p.y = rng.below(NY);
+		if (!p.fits(g.blocks)) continue;
+		if (rng.below(2))
+		{
+			const Rotation& rot = p.rot();
+			p.y = dropRow(g.blocks.rows, rot, p.x + rot.xmin, p.y + rot.ymin)
+				- rot.ymin;
+		}
+		ps.push_back(p);
+	}
+
+	int64_t plain = 0, kicked = 0, mismatches = 0;
+	for (const Piece& p: ps)
+		for (int dr = -1; dr <= 1; dr += 2)
+		{
+			Piece q = p;
+			q.r = (q.r + NROT + dr) % NROT;
+			plain += q.fits(g.blocks);
+
+			int k = kick(g.blocks.rows, p.t, p.r, dr, p.x, p.y);
+			kicked += k >= 0;
+
+			g.piece = p;
+			g.apply({dr > 0 ? CMD_CCW : CMD_CW});
+			if ((g.piece.r != p.r) != (k >= 0)) mismatches++;
+		}
+	fmt::print("rotation: {:.1f}% of turns fit in place, {:.1f}% with kicks, {} mismatches\n",
+			50.0 * plain / ps.size(), 50.0 * kicked / ps.size(), mismatches);
+
+	const int64_t n = 10000000;
+	double before = bench("rotation: fits() in place", n, [&](int64_t i)
+	{
+		Piece q = ps[i % ps.size()];
+		q.r = (q.r + NROT + 1) % NROT;
+		sink = (float) q.fits(g.blocks);
+	});
+	double after = bench("rotation: kick() on a Board", n, [&](int64_t i)
+	{
+		const Piece& p = ps[i % ps.size()];
+		sink = (float) kick(g.blocks.rows, p.t, p.r, 1, p.x, p.y);
+	});
+	double game = bench("rotation: Game::apply(CMD_CCW)", n, [&](int64_t i)
+	{
+		g.piece = ps[i % ps.size()];
+		g.apply({CMD_CCW});
+		sink = (float) g.piece.r;
+	});
+	fmt::print("rotation: {:.3g} turns/s with kicks, {:.3g} through the Game, {:.1f}x the cost of no kicks\n",
+			1e9 / after, 1e9 / game, after / before);
+}
+
+//========================================================================
+
+void benchAi()
+{
+	// Placement search throughput on random ragged boards
+
+	const int NBOARDS = 64;
+	std::vector<Board> boards = randomBoards(NBOARDS);
+
+	Weights w;
+	int64_t nevals = 0;
+	double ns = bench("ai: bestPlacement", 200000, [&](int64_t i)
+	{
+		Placement p = bestPlacement(boards[i % NBOARDS],
+				spawnPiece(static_cast<PieceType>(i % NTYPES)), w, &nevals);
+		sink = (float) p.score;
+	});
+	double per = (double) nevals / 200000;
+	fmt::print("ai: {:.1f} placements/piece, {:.3g} placements/s\n", per,
+			1e9 * per / ns);
+}
+
+//========================================================================
+
+void benchLookahead()
+{
+	// Cost of one decision with a depth 2 and 3 lookahead, with a full search
+	// and with a beam, on one thread and then spread over the pool
+
+	const int NBOARDS = 16;
+	std::vector<Board> boards = randomBoards(NBOARDS);
+	Weights w;
+
+	// Depth and beam.  A full depth 3 search is slow, so it gets fewer reps
+	const int CONFIGS[3][2] = {{2, 0}, {3, 0}, {3, 8}};
+
+	ThreadPool pool;
+	for (auto& c: CONFIGS)
+	{
+		const int depth = c[0], beam = c[1];
+		const int64_t n = depth == 3 && !beam ? 20 : 500;
+		for (ThreadPool* p: {(ThreadPool*) nullptr, &pool})
+		{
+			int64_t nevals = 0;
+			double ns = bench(fmt::format("ai: depth {} beam {}, {} thread(s)",
+					depth, beam, p ? p->size() : 1), n, [&](int64_t i)
+			{
+				PieceType pieces[1 + NPREVIEW];
+				for (int k = 0; k < depth; k++)
+					pieces[k] = static_cast<PieceType>((i + 3 * k) % NTYPES);
+
+				Placement pl = bestPlacement(boards[i % NBOARDS],
+						spawnPiece(pieces[0]), pieces + 1, depth, beam, w, &nevals,
+						p);
+				sink = (float) pl.score;
+			});
+
+			fmt::print("ai: {:.3g} ms/piece, {:.0f} evals/piece\n",
+					1e-6 * ns, (double) nevals / n);
+		}
+	}
+}
+
+//========================================================================
+
+void benchRng()
+{
+	// Piece generation cost:  a random type in [0, NTYPES) per op, single
+	// threaded and then from every thread at once
+
+	const int64_t n = 20000000;
+
+	srand(42);
+	double before = bench("rng: rand() % NTYPES", n, [](int64_t)
+	{
+		sink = (float) (rand() % NTYPES);
+	});
+
+	Rng rng(42);
+	double after = bench("rng: xoshiro256** below(NTYPES)", n, [&](int64_t)
+	{
+		sink = (float) rng.below(NTYPES);
+	});
+	fmt::print("rng: speedup {:.1f}x\n", before / after);
+
+	// glibc rand() takes a lock, so threads hammering it contend.  Each thread
+	// owns its own Rng
+	ThreadPool pool;
+	std::vector<Rng> rngs;
+	for (int i = 0; i < pool.size(); i++)
+		rngs.emplace_back(i);
+
+	const int64_t nchunk = 1000;
+	auto threaded = [&](const std::string& name, auto f)
+	{
+		return bench(fmt::format("rng: {}, {} threads", name, pool.size()), 1,
+				[&](int64_t)
+		{
+			pool.parallelFor(n / nchunk, [&](int64_t, int thread)
+			{
+				uint32_t s = 0;
+				for (int64_t j = 0; j < nchunk; j++)
+					s += f(thread);
+				sink = (float) s;
+			});
+		}, n);
+	};
+	before = threaded("rand()", [](int)
+	{
+		return (uint32_t) (rand() % NTYPES);
+	});
+	after = threaded("per-thread Rng", [&](int thread)
+	{
+		return rngs[thread].below(NTYPES);
+	});
+	fmt::print("rng: threaded speedup {:.1f}x\n", before / after);
+}
+
+//========================================================================
+
+void logSync(const std::string& str, std::FILE* f)
+{
+	// The old log(), kept as a baseline:  format, concatenate and flush on
+	// the calling thread
+	fmt::print(f, me + ": " + str + "\n");
+	fflush(f);
+}
+
+void benchLogging()
+{
+	// Cost of one message, and of a spawn and settle with logging on and off.
+	// Everything is written to the null device, so only the logging itself
+	// is timed, not the terminal
+
+#if defined(_WIN32)
+	std::FILE* null = fopen("NUL", "w");
+#else
+	std::FILE* null = fopen("/dev/null", "w");
+#endif
+	if (!null)
+	{
+		fmt::print("log: no null device, skipping\n");
+		return;
+	}
+	logOutput(null, null);
+
+	const int64_t n = 200000;
+	double before = bench("log: format + fflush", n, [&](int64_t i)
+	{
+		logSync(fmt::format("cleared {} line(s), {} total", i % 4, i), null);
+	});
+
+	// Time the caller only, in bursts short enough to fit in the queue, and
+	// let the logging thread catch up in between
+	const int BURST = 500;
+	double ns = 0;
+	for (int64_t j = 0; j < n; j += BURST)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		for (int64_t i = j; i < j + BURST; i++)
+			logAt<LOG_INFO>("cleared lines", {{"n", i % 4}, {"total", i}});
+		auto t1 = std::chrono::steady_clock::now();
+		ns += std::chrono::duration<double, std::nano>(t1 - t0).count();
+		logFlush();
+	}
+	double after = ns / n;
+	fmt::print("{:<40} {:>12.1f} ns/op\n", "log: queued, structured", after);
+	fmt::print("log: speedup {:.1f}x\n", before / after);
+	bench("log: compiled out", n, [&](int64_t i)
+	{
+		logAt<LOG_TRACE>("settled block", {{"ix", i % 10}, {"iy", i}});
+	});
+
+	// Hard drop random pieces straight down, starting over when the stack
+	// reaches the top.  Each op is one spawn and one settle
+	Game game;
+	int64_t seed = 0;
+	game.newGame(seed);
+	auto play = [&](int64_t i)
+	{
+		game.apply({CMD_MOVETO, game.piece.r, (uint8_t) (i % (NX - 3))});
+		game.apply({CMD_DROP});
+		if (game.over)
+			game.newGame(++seed);
+	};
+
+	const int64_t npieces = 2000000;
+	quiet = true;
+	after = bench("log: spawn/settle, logging off", npieces, play);
+	quiet = false;
+	before = bench("log: spawn/settle, logging on", npieces, play);
+	logFlush();
+	fmt::print("log: spawn/settle {:.3g} vs {:.3g} pieces/s with logging on, level {}\n",
+			1e9 / after, 1e9 / before, TETRIS_LOG_LEVEL);
+
+	logOutput(stdout, stderr);
+	fclose(null);
+}
+
+//========================================================================
+
+int main()
+{
+	benchAi();
+	benchLookahead();
+	benchRng();
+	benchCollision();
+	benchBatchCollision();
+	benchLanding();
+	benchRotation();
+	benchTransform();
+	benchLogging();
+	return 0;
+}
+
+//========================================================================
+
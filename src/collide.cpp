@@ -0,0 +1,282 @@
+
+//========================================================================
+//
+// Batch collision
+//
+//========================================================================
+
+#include <collide.h>
+
+// Standard
+#include <algorithm>
+
+// The AVX2 kernels are compiled for AVX2 on their own, whatever the rest of
+// the build targets, and only called if the CPU has it.  MSVC can't do that
+// per function, so there they're only in builds with /arch:AVX2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+ #define HAVE_AVX2 1
+ #define TARGET_AVX2 __attribute__((target("avx2")))
+ #define FLATTEN __attribute__((flatten))
+#elif defined(_MSC_VER) && defined(__AVX2__)
+ #define HAVE_AVX2 1
+ #define TARGET_AVX2
+ #define FLATTEN
+#endif
+
+// SSE2 is part of x86-64, so that level is always there
+#if defined(__SSE2__) || defined(_M_X64)
+ #define HAVE_SSE2 1
+ #include <emmintrin.h>
+#endif
+
+#if defined(HAVE_AVX2)
+ #include <immintrin.h>
+#endif
+
+//========================================================================
+
+SimdLevel simd = simdSupported();
+
+namespace
+{
+
+// Row masks of each rotation, indexed by t * NROT + r, with the rows past the
+// top of the piece left 0, so that every test can do all 4 rows.  Shifting
+// them left by ix puts them in the piece's columns
+typedef std::array<RowBits, NBLOCKS> RowMasks;
+
+constexpr std::array<RowMasks, NTYPES * NROT> initMasks()
+{
+	std::array<RowMasks, NTYPES * NROT> masks = {};
+	for (int t = 0; t < NTYPES; t++)
+		for (int r = 0; r < NROT; r++)
+			for (int k = 0; k < NBLOCKS; k++)
+				masks[t * NROT + r][k] = ROTATIONS[t][r].rowbits[k];
+	return masks;
+}
+
+alignas(32) constexpr std::array<RowMasks, NTYPES * NROT> MASKS = initMasks();
+
+// Every column left of the first one or right of the last one is a wall.  A
+// piece with its min corner right of the last column always hits the walls
+// in the board, so the only thing that needs checking first is the left side
+inline bool inReach(int ix)
+{
+	return (unsigned) ix < (unsigned) NXFULL;
+}
+
+// Index into WalledBoard::rows of the bottom row of a piece at row iy.
+// Anything above the grid is as empty as the row just above it, and anything
+// far enough below is solid, so clamping iy keeps the answer
+inline int rowIndex(int iy)
+{
+	return std::min(std::max(iy, -WALL_PAD), NY) + WALL_PAD;
+}
+
+//========================================================================
+
+// Each kernel tests one candidate at a time, with the 4 rows under it side by
+// side in SIMD lanes:  an unaligned load of the board rows, a shift of the
+// masks, an AND and a test for zero.  That beats 4 candidates at a time
+// across lanes, which needs a gather for every row
+
+struct Scalar
+{
+	RowMasks m;
+
+	Scalar(const Cand& c)
+	{
+		const RowMasks& mask = MASKS[c.t * NROT + c.r];
+		for (int k = 0; k < NBLOCKS; k++)
+			m[k] = mask[k] << c.ix;
+	}
+
+	bool fits(const RowBits* rows) const
+	{
+		RowBits hit = 0;
+		for (int k = 0; k < NBLOCKS; k++)
+			hit |= m[k] & rows[k];
+		return hit == 0;
+	}
+};
+
+#if defined(HAVE_SSE2)
+
+struct Sse2
+{
+	// Rows 0-1 and 2-3
+	__m128i lo, hi;
+
+	Sse2(const Cand& c)
+	{
+		const __m128i* mask = (const __m128i*) MASKS[c.t * NROT + c.r].data();
+		__m128i sh = _mm_cvtsi32_si128(c.ix);
+		lo = _mm_sll_epi64(_mm_load_si128(mask + 0), sh);
+		hi = _mm_sll_epi64(_mm_load_si128(mask + 1), sh);
+	}
+
+	bool fits(const RowBits* rows) const
+	{
+		const __m128i* r = (const __m128i*) rows;
+		__m128i hit = _mm_or_si128(
+				_mm_and_si128(lo, _mm_loadu_si128(r + 0)),
+				_mm_and_si128(hi, _mm_loadu_si128(r + 1)));
+		return _mm_movemask_epi8(_mm_cmpeq_epi32(hit, _mm_setzero_si128()))
+			== 0xffff;
+	}
+};
+
+#endif
+
+#if defined(HAVE_AVX2)
+
+struct Avx2
+{
+	__m256i m;
+
+	TARGET_AVX2 Avx2(const Cand& c)
+	{
+		m = _mm256_sll_epi64(
+				_mm256_load_si256((const __m256i*) MASKS[c.t * NROT + c.r].data()),
+				_mm_cvtsi32_si128(c.ix));
+	}
+
+	TARGET_AVX2 bool fits(const RowBits* rows) const
+	{
+		return _mm256_testz_si256(m, _mm256_loadu_si256((const __m256i*) rows));
+	}
+};
+
+#endif
+
+//========================================================================
+
+// The batch loops, the same for every kernel
+
+template <typename K>
+inline int fitsLoop(const WalledBoard& b, const Cand* c, int n, uint8_t* out)
+{
+	int nfit = 0;
+	for (int i = 0; i < n; i++)
+	{
+		bool fit = inReach(c[i].ix)
+			&& K(c[i]).fits(b.rows.data() + rowIndex(c[i].iy));
+		out[i] = fit;
+		nfit += fit;
+	}
+	return nfit;
+}
+
+template <typename K>
+inline void dropLoop(const WalledBoard& b, Cand* c, int n)
+{
+	// Only the start needs clamping.  From there the piece can only go down,
+	// and it stops at the floor before it gets past the padding
+	const RowBits* rows = b.rows.data();
+	for (int i = 0; i < n; i++)
+	{
+		K k(c[i]);
+		const RowBits* p = rows + rowIndex(std::min(c[i].iy, NY));
+		while (k.fits(p - 1)) p--;
+		c[i].iy = (int) (p - rows) - WALL_PAD;
+	}
+}
+
+#if defined(HAVE_AVX2)
+
+// Compiled for AVX2 as a whole, with everything inlined, since the kernel
+// can't be inlined into a loop that isn't
+TARGET_AVX2 FLATTEN int fitsLoopAvx2(const WalledBoard& b, const Cand* c, int n,
+		uint8_t* out)
+{
+	return fitsLoop<Avx2>(b, c, n, out);
+}
+
+TARGET_AVX2 FLATTEN void dropLoopAvx2(const WalledBoard& b, Cand* c, int n)
+{
+	dropLoop<Avx2>(b, c, n);
+}
+
+#endif
+
+}
+
+//========================================================================
+
+WalledBoard::WalledBoard(const Board& b)
+{
+	const RowBits WALLS = ~FULLROW;
+	for (int k = 0; k < WALL_PAD; k++)
+	{
+		rows[k] = ~(RowBits) 0;
+		rows[NY + WALL_PAD + k] = WALLS;
+	}
+	for (int iy = 0; iy < NY; iy++)
+		rows[iy + WALL_PAD] = b[iy] | WALLS;
+}
+
+//========================================================================
+
+SimdLevel simdSupported()
+{
+#if defined(HAVE_AVX2) && defined(__GNUC__)
+	// This can run before main(), from the initializer of simd
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+#elif defined(HAVE_AVX2)
+	return SIMD_AVX2;
+#endif
+
+#if defined(HAVE_SSE2)
+	return SIMD_SSE2;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+//========================================================================
+
+const char* simdName(SimdLevel level)
+{
+	switch (level)
+	{
+		case SIMD_SSE2: return "sse2";
+		case SIMD_AVX2: return "avx2";
+		default       : return "scalar";
+	}
+}
+
+//========================================================================
+
+int fitsBatch(const WalledBoard& b, const Cand* c, int n, uint8_t* out)
+{
+	switch (simd)
+	{
+#if defined(HAVE_AVX2)
+		case SIMD_AVX2: return fitsLoopAvx2(b, c, n, out);
+#endif
+#if defined(HAVE_SSE2)
+		case SIMD_SSE2: return fitsLoop<Sse2>(b, c, n, out);
+#endif
+		default       : return fitsLoop<Scalar>(b, c, n, out);
+	}
+}
+
+//========================================================================
+
+void dropBatch(const WalledBoard& b, Cand* c, int n)
+{
+	switch (simd)
+	{
+#if defined(HAVE_AVX2)
+		case SIMD_AVX2: dropLoopAvx2(b, c, n); break;
+#endif
+#if defined(HAVE_SSE2)
+		case SIMD_SSE2: dropLoop<Sse2>(b, c, n); break;
+#endif
+		default       : dropLoop<Scalar>(b, c, n); break;
+	}
+}
+
+//========================================================================
+
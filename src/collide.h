@@ -0,0 +1,73 @@
+
+//========================================================================
+//
+// Batch collision:  test many candidate placements against one board at
+// once, with AVX2 where the CPU has it, SSE2 on any other x86-64, or plain
+// 64-bit words anywhere else
+//
+//========================================================================
+
+#ifndef TETRIS_COLLIDE_H
+#define TETRIS_COLLIDE_H
+
+#include <array>
+#include <stdint.h>
+
+#include <grid.h>
+#include <piece.h>
+
+//========================================================================
+
+// One placement to test:  piece type, rotation state, and the cell of its
+// bounding box min corner, like fits() takes
+struct Cand
+{
+	int32_t ix = 0, iy = 0;
+	PieceType t = I;
+	uint8_t r = 0;
+};
+
+// Rows of padding on each side of a WalledBoard, enough for the tallest piece
+const int WALL_PAD = NBLOCKS;
+
+// A copy of a Board with the walls and floor filled in.  Below the floor,
+// rows are solid, and every row has the bits right of the last reachable
+// column set.  Then whether a piece fits anywhere within reach is just
+// whether its row masks miss these rows, with no bounds checks
+struct WalledBoard
+{
+	// Row iy of the board is rows[iy + WALL_PAD]
+	std::array<RowBits, NY + 2 * WALL_PAD> rows;
+
+	explicit WalledBoard(const Board& b);
+};
+
+// Instruction sets the kernels can use
+enum SimdLevel
+{
+	SIMD_SCALAR,
+	SIMD_SSE2,
+	SIMD_AVX2
+};
+
+// Best level that this CPU can run
+SimdLevel simdSupported();
+
+// Level the kernels use.  Defaults to simdSupported().  Lowering it is only
+// for benchmarking
+extern SimdLevel simd;
+
+const char* simdName(SimdLevel level);
+
+// Set out[i] to 1 if candidate c[i] fits on b, else 0, for i < n.  Same
+// answers as fits(), for any candidate.  Returns the number that fit
+int fitsBatch(const WalledBoard& b, const Cand* c, int n, uint8_t* out);
+
+// Drop each of the n candidates straight down as far as it goes, like
+// dropRow(), updating c[i].iy.  Each one has to fit where it starts
+void dropBatch(const WalledBoard& b, Cand* c, int n);
+
+//========================================================================
+
+#endif
+
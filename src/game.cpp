@@ -0,0 +1,516 @@
+
+//========================================================================
+//
+// Game logic
+//
+//========================================================================
+
+#include <game.h>
+
+// Standard
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tetris
+#include <log.h>
+#include <replay.h>
+
+//========================================================================
+
+// 5 cells per second
+int32_t gravity = 5 * CELL / TICK_HZ;
+
+// Longest frame that's simulated in full.  Anything longer, e.g. while the
+// window is being dragged, just runs slow instead of bursting through a
+// backlog of ticks
+const double MAX_FRAME = 0.25;
+
+//========================================================================
+
+void Game::newPiece()
+{
+	logAt<LOG_TRACE>("Starting newPiece()");
+	Piece p;
+
+	p.x = SPAWN_X;
+	p.y = SPAWN_Y;
+	p.r = rng.below(NROT);
+
+	// Take the next type from the front of the preview queue and deal a new
+	// one onto the back
+	p.t = preview[0];
+	for (int i = 0; i + 1 < NPREVIEW; i++)
+		preview[i] = preview[i + 1];
+	preview[NPREVIEW - 1] = nextType();
+
+	//pieces.push_back(p);
+	piece = p;
+
+	ip++;
+
+	//log(fmt::format("ip = {}", ip));
+
+	if (!piece.fits(blocks))
+		end();
+}
+
+//========================================================================
+
+PieceType Game::nextType()
+{
+	if (randomizer == UNIFORM)
+		return static_cast<PieceType>(rng.below(NTYPES));
+
+	// Refill and shuffle (Fisher-Yates) when the bag runs out, then deal from
+	// the end
+	if (nbag == 0)
+	{
+		for (int i = 0; i < NTYPES; i++)
+			bag[i] = static_cast<PieceType>(i);
+		for (int i = NTYPES - 1; i > 0; i--)
+			std::swap(bag[i], bag[rng.below(i + 1)]);
+		nbag = NTYPES;
+	}
+	return bag[--nbag];
+}
+
+//========================================================================
+
+void Game::newGame(uint64_t seed)
+{
+	// Empty the grid and start over with a new piece.  The same seed and
+	// randomizer always deal the same sequence of pieces
+	blocks.clear();
+	lines = 0;
+	over = false;
+	rng.seed(seed);
+	nbag = 0;
+	tick = 0;
+	prev_ip = -1;
+
+	for (auto& t: preview)
+		t = nextType();
+
+	if (recorder)
+		recorder->start(seed, randomizer);
+
+	ip = -1;
+	newPiece();
+}
+
+//========================================================================
+
+void Game::apply(const Command& c)
+{
+	// Do what a key, a script or the autoplayer asks, in the current tick
+
+	if (recorder)
+		recorder->command(tick, c);
+
+	switch (c.type)
+	{
+		case CMD_LEFT  : move(-1,  0); break;
+		case CMD_RIGHT : move( 1,  0); break;
+		case CMD_DOWN  : move( 0, -1); break;
+		case CMD_CCW   : rotate( 1);   break;
+		case CMD_CW    : rotate(-1);   break;
+		case CMD_DROP  : drop();       break;
+		case CMD_MOVETO: moveTo(c.r, c.ix); break;
+		default: break;
+	}
+}
+
+//========================================================================
+
+void Game::onLineClear(const LineClear& lc)
+{
+	// Scoring hook for the rows removed when a piece settles
+
+	if (lc.n == 0) return;
+
+	lines += lc.n;
+	logAt<LOG_INFO>("cleared lines", {{"n", lc.n}, {"total", lines}});
+}
+
+//========================================================================
+
+void Game::settle()
+{
+	// Only make a new piece for collision in y dir.  Only downward motion
+	// (either natural falling or a drop) can settle a piece, not rotations or
+	// x motion.  A piece that settles sticking out of the top ends the game
+	bool out = piece.y + piece.rot().ymax >= NY;
+
+	onLineClear(piece.decompose(blocks));
+	if (out)
+		end();
+	else
+		newPiece();
+}
+
+//========================================================================
+
+void Game::end()
+{
+	logAt<LOG_INFO>("Game over", {{"pieces", ip}, {"lines", lines}});
+	over = true;
+}
+
+//========================================================================
+
+LineClear Piece::decompose(Grid& blocks) const
+{
+	// Decompose a piece into individual blocks in the Grid "blocks" of
+	// PieceType's, which saves the state of the settled blocks.  When lines
+	// are eliminated later, individual blocks have to be treated instead of
+	// whole pieces, and there is only ever 1 active piece, so there's no
+	// vector of pieces at all.  The Grid also keeps a bitboard of occupied
+	// cells for collision checks.  Blocks above the grid are dropped
+
+	logAt<LOG_TRACE>("Starting Piece::decompose()");
+	const Rotation& ro = rot();
+	int iylo = NY, iyhi = -1;
+	for (int i = 0; i < NBLOCKS; i++)
+	{
+		int ix = x + ro.dx[i];
+		int iy = y + ro.dy[i];
+		logAt<LOG_TRACE>("settled block", {{"ix", ix}, {"iy", iy}});
+		if (iy >= NY) continue;
+
+		blocks.set(ix, iy, t);
+		iylo = std::min(iylo, iy);
+		iyhi = std::max(iyhi, iy);
+
+		// TODO: with textures, the rotation state could also be saved to
+		// a separate vec
+	}
+
+	// Only the rows that this piece landed in can have become full
+	return blocks.clearLines(iylo, iyhi);
+}
+
+//========================================================================
+
+void Piece::getBlock(int i, float& bx, float& by) const
+{
+	// Get the center xy world coordinates of block index i in this piece
+	const Rotation& ro = rot();
+
+	bx = XMIN + x + ro.dx[i] + 0.5f;
+	by = YMIN + y + ro.dy[i] + 0.5f - (float) fy / CELL;
+	//log(fmt::format("bx by = {} {}", bx, by));
+}
+
+//========================================================================
+
+void Piece::getCenter(float& cx, float& cy) const
+{
+	// Get the world coordinates of the center of rotation of this piece, which
+	// is where BLOCKS is relative to
+	const Rotation& ro = rot();
+
+	cx = XMIN + x + ro.sx;
+	cy = YMIN + y + ro.sy - (float) fy / CELL;
+}
+
+//========================================================================
+
+std::array<float, 2 * NBLOCKS> Piece::getCenters() const
+{
+	// Get the xy coordinates of the center of each block in this piece
+
+	//log("Starting Piece::getCenters()");
+
+	std::array<float, 2 * NBLOCKS> xy;
+
+	for (int i = 0; i < NBLOCKS; i++)
+		getBlock(i, xy[2*i+0], xy[2*i+1]);
+
+	return xy;
+}
+
+//========================================================================
+
+bool Piece::fits(const Grid& blocks) const
+{
+	// Exact integer check against the walls, the floor and the settled blocks,
+	// in every row the piece overlaps
+
+	const Rotation& ro = rot();
+	int ix = x + ro.xmin, iy = y + ro.ymin;
+	return ::fits(blocks.rows, ro, ix, iy)
+		&& (fy == 0 || ::fits(blocks.rows, ro, ix, iy - 1));
+}
+
+//========================================================================
+
+bool Game::place(Piece p)
+{
+	// Make p the active piece if it fits.  If it doesn't, but it's within SLIP
+	// of the row below and fits there, snap it down into that row instead.
+	// Returns false, and leaves the active piece alone, if neither works
+
+	if (!p.fits(blocks))
+	{
+		if (p.fy < CELL - SLIP) return false;
+
+		p.y--;
+		p.fy = 0;
+		if (!p.fits(blocks)) return false;
+	}
+
+	piece = p;
+	return true;
+}
+
+//========================================================================
+
+void Game::move(int dx, int dy)
+{
+	// Move the active piece by whole cells, if it fits there.  Moving down
+	// stops on top of whatever's below instead of settling, and gravity
+	// settles it on the next tick
+
+	//log("Starting Piece::move()");
+
+	// Nothing moves once the game is over
+	if (over) return;
+
+	Piece p = piece;
+	p.x += dx;
+	p.y += dy;
+	if (place(p) || dy >= 0 || dx != 0) return;
+
+	// Moving down into something only goes as far as the last free whole row
+	// on the way.  That's never higher than the piece already is, since the
+	// row below is free whenever fy > 0
+	p = piece;
+	p.fy = 0;
+	while (p.y > piece.y + dy)
+	{
+		p.y--;
+		if (!p.fits(blocks))
+		{
+			p.y++;
+			break;
+		}
+	}
+	piece = p;
+}
+
+//========================================================================
+
+void Game::rotate(int dr)
+{
+	// Rotate CCW for dr > 0 or CW for dr < 0, kicking the piece to the first
+	// offset in its kick table where it fits, or not at all if none do
+	//
+	// Add an extra NROT to prevent underflow.  Anyway for a 1-byte int
+	// mod 4, it doesn't matter because 255%4 == 3%4
+
+	if (over) return;
+
+	const Kicks& kicks = KICKS[piece.t][piece.r][dr > 0 ? 0 : 1];
+	for (int k = 0; k < NKICKS; k++)
+	{
+		Piece p = piece;
+		p.r = (p.r + NROT + dr) % NROT;
+		p.x += kicks[k].dx;
+		p.y += kicks[k].dy;
+		if (place(p))
+		{
+			logAt<LOG_DEBUG>("rotated", {{"r", piece.r}, {"kick", k}});
+			return;
+		}
+	}
+}
+
+//========================================================================
+
+bool Game::moveTo(uint8_t r, int ix)
+{
+	// Put the active piece in rotation state r with its bounding box min
+	// corner in column ix, as if by moving it sideways and turning it there
+	// with kicks.  It ends up in the first pose that reach() finds, which is
+	// where the autoplayer expects it.  Returns false, and leaves the piece
+	// alone, if it can't get there or r isn't a rotation state
+
+	if (over || r >= NROT || ix < 0 || ix >= NXFULL) return false;
+
+	Reach re;
+	reach(blocks.rows, piece.t, piece.r, piece.x, piece.y, piece.fy != 0, re);
+	if (re.iy[r][ix] == NOREACH) return false;
+
+	const Rotation& rot = ROTATIONS[piece.t][r];
+	piece.r = r;
+	piece.x = ix - rot.xmin;
+	piece.y = re.iy[r][ix] - rot.ymin;
+	return true;
+}
+
+//========================================================================
+
+void Game::drop()
+{
+	// Hard drop:  move the active piece straight down as far as it goes and
+	// settle it there
+
+	if (over) return;
+
+	piece = ghost();
+	settle();
+}
+
+//========================================================================
+
+Piece Game::ghost() const
+{
+	// The active piece where a hard drop would put it, for drawing a preview
+	// of where it lands.  The piece fits at any height it overlaps, so it
+	// fits at the top whole row of them, and it falls from there
+
+	Piece p = piece;
+	const Rotation& rot = p.rot();
+	p.y = blocks.landRow(rot, p.x + rot.xmin, p.y + rot.ymin) - rot.ymin;
+	p.fy = 0;
+	return p;
+}
+
+//========================================================================
+
+void Game::step()
+{
+	// Run one tick
+
+	prev = piece;
+	prev_ip = ip;
+	tick++;
+
+	if (!over)
+		fall();
+
+	if (recorder)
+		recorder->tick(tick, hash());
+}
+
+//========================================================================
+
+void Game::fall()
+{
+	// One tick of gravity.  The piece goes down a row at a time, so it can't
+	// pass through a block however far it falls in a tick, and it lands
+	// exactly on top of whatever stops it
+
+	Piece p = piece;
+	p.fy += gravity;
+	for (;;)
+	{
+		// Going any lower than row y needs row y - 1 to be free
+		Piece below = p;
+		below.y--;
+		below.fy = 0;
+		if (!below.fits(blocks))
+		{
+			piece = p;
+			piece.fy = 0;
+			settle();
+			return;
+		}
+
+		if (p.fy < CELL) break;
+		below.fy = p.fy - CELL;
+		p = below;
+	}
+	piece = p;
+}
+
+//========================================================================
+
+Piece Game::lerpPiece(float alpha) const
+{
+	// The active piece alpha of the way from the start of the last tick to
+	// now, for drawing.  Only y is interpolated.  x and rotation only change
+	// on input and snap to the grid anyway, and a piece that has just spawned
+	// has nowhere to come from
+
+	Piece p = piece;
+	if (prev_ip == ip)
+	{
+		// Heights in 1/CELL cells
+		int64_t a = (int64_t) prev .y * CELL - prev .fy;
+		int64_t b = (int64_t) piece.y * CELL - piece.fy;
+		int64_t h = a + (int64_t) lround(alpha * (double) (b - a));
+
+		// Round the row up, so that fy >= 0.  Heights are never negative,
+		// since the piece is above the floor
+		p.y = (int) ((h + CELL - 1) / CELL);
+		p.fy = (int32_t) ((int64_t) p.y * CELL - h);
+	}
+	return p;
+}
+
+//========================================================================
+
+uint64_t Game::hash() const
+{
+	// Hash of everything that decides how the game goes on from here:  the
+	// settled blocks, the active piece, the counters, and the generator state
+
+	uint64_t h = 0;
+	auto mix = [&](uint64_t v)
+	{
+		uint64_t x = h ^ v;
+		h = splitmix64(x);
+	};
+
+	// The block types 8 at a time.  This runs every tick while recording or
+	// replaying, so it has to be cheap
+	const uint8_t* types = (const uint8_t*) blocks.types.data();
+	const size_t NTYPEBYTES = sizeof(blocks.types);
+	static_assert(sizeof(PieceType) == 1, "block types aren't bytes");
+	for (size_t i = 0; i < NTYPEBYTES; i += 8)
+	{
+		uint64_t v = 0;
+		memcpy(&v, types + i, std::min<size_t>(8, NTYPEBYTES - i));
+		mix(v);
+	}
+
+	mix((uint64_t) piece.x);
+	mix((uint64_t) piece.y);
+	mix((uint64_t) piece.fy);
+	mix(piece.r);
+	mix(piece.t);
+
+	mix((uint64_t) ip);
+	mix((uint64_t) lines);
+	mix((uint64_t) tick);
+	mix(over);
+	for (auto t: preview)
+		mix(t);
+
+	// The next draw from a copy of the generator stands in for its state
+	Rng r = rng;
+	mix(r());
+
+	// What's left in the bag decides the next pieces as much as the generator
+	mix((uint64_t) nbag);
+	for (int i = 0; i < nbag; i++)
+		mix(bag[i]);
+
+	return h;
+}
+
+//========================================================================
+
+int FixedStep::advance(double dt)
+{
+	acc += std::min(std::max(dt, 0.0), MAX_FRAME);
+
+	int n = (int) (acc / TICK);
+	acc -= n * TICK;
+	return n;
+}
+
+//========================================================================
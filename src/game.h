@@ -0,0 +1,186 @@
+
+//========================================================================
+//
+// Game logic:  the active piece and the settled blocks.  Nothing in here
+// touches GL, so it runs with or without a window
+//
+//========================================================================
+
+#ifndef TETRIS_GAME_H
+#define TETRIS_GAME_H
+
+#include <array>
+#include <stdint.h>
+
+#include <grid.h>
+#include <piece.h>
+#include <rng.h>
+
+//========================================================================
+
+// Sub-cell positions are fixed point, with this many steps per cell
+const int32_t CELL = 1 << 16;
+
+// The game logic only ever sees whole cells and fixed point fractions of
+// them, so it plays out the same with any compiler and any optimization
+// level.  Floats are only for drawing
+class Piece
+{
+	public:
+		// Grid cell of the piece's origin.  Block i is in cell
+		// (x + dx[i], y + dy[i]) of its Rotation
+		int x = 0, y = 0;
+
+		// How far the piece has fallen from row y towards row y - 1, in
+		// [0, CELL).  While it's not 0 the piece overlaps both rows, and both
+		// have to be free
+		int32_t fy = 0;
+
+		uint8_t r = 0;  // rotation state in [0, 3]
+		PieceType t;
+
+		const Rotation& rot() const
+		{
+			return ROTATIONS[t][r];
+		}
+
+		bool fits(const Grid& blocks) const;
+		LineClear decompose(Grid& blocks) const;
+
+		// World coordinates, for drawing only
+		void getBlock(int i, float& bx, float& by) const;
+		void getCenter(float& cx, float& cy) const;
+		std::array<float, 2 * NBLOCKS> getCenters() const;
+};
+
+//========================================================================
+
+// Downward piece speed, in 1/CELL cells per tick
+extern int32_t gravity;
+
+// A piece that's within this of the row below can still slide or turn into
+// a gap there, by snapping down into it.  This is what makes it possible to
+// slip a piece under a ledge
+const int32_t SLIP = CELL / 4;
+
+// Simulation rate.  Gravity and the autoplayer advance in whole ticks, no
+// matter how often frames are drawn
+const int TICK_HZ = 120;
+const double TICK = 1.0 / TICK_HZ;
+
+// Number of upcoming piece types that are known in advance, for the preview
+// and for the autoplayer's lookahead
+const int NPREVIEW = 3;
+
+// Origin cell where new pieces appear:  top row, middle column
+const int SPAWN_X = NXFULL / 2, SPAWN_Y = NY - 1;
+
+// Everything that a player or the autoplayer can do to a game, besides
+// letting it tick.  They all go through Game::apply(), so that one stream of
+// them is a complete record of a game
+enum CmdType : uint8_t
+{
+	CMD_LEFT, CMD_RIGHT, CMD_DOWN, CMD_CCW, CMD_CW, CMD_DROP, CMD_MOVETO,
+	NCMDS
+};
+
+struct Command
+{
+	CmdType type = NCMDS;
+
+	// For CMD_MOVETO:  rotation state and bounding box min column.  The piece
+	// only gets there if it can by moving sideways and turning, see reach()
+	uint8_t r = 0, ix = 0;
+};
+
+class Recorder;
+
+//========================================================================
+
+// Everything that belongs to one game, so that many games can run side by
+// side, e.g. on different threads in tetris-sim
+class Game
+{
+	public:
+		Piece piece;
+		Grid blocks;
+
+		// Active piece index
+		int64_t ip = -1;
+
+		// Number of lines cleared so far
+		int64_t lines = 0;
+
+		// Set when a new piece spawns on top of settled blocks
+		bool over = false;
+
+		// Number of ticks run so far
+		int64_t tick = 0;
+
+		// Types of the next pieces to spawn, soonest first
+		std::array<PieceType, NPREVIEW> preview;
+
+		// Piece generator.  Set randomizer before newGame()
+		Rng rng;
+		Randomizer randomizer = UNIFORM;
+
+		// If set, every new game, command and tick is recorded here.  Only
+		// the thread that runs the game may touch it
+		Recorder* recorder = nullptr;
+
+		void newGame(uint64_t seed);
+		void apply(const Command& c);
+		void step();
+		Piece lerpPiece(float alpha) const;
+		Piece ghost() const;
+		uint64_t hash() const;
+
+	private:
+
+		// The active piece and its index as of the start of the last tick
+		Piece prev;
+		int64_t prev_ip = -1;
+
+		// Remaining piece types in the current bag for BAG7
+		std::array<PieceType, NTYPES> bag;
+		int nbag = 0;
+
+		void newPiece();
+		void move(int dx, int dy);
+		void rotate(int dr);
+		bool moveTo(uint8_t r, int ix);
+		void drop();
+
+		PieceType nextType();
+		bool place(Piece p);
+		void fall();
+		void settle();
+		void end();
+		void onLineClear(const LineClear& lc);
+};
+
+//========================================================================
+
+// Turns variable frame times into a whole number of fixed ticks.  Time left
+// over is carried to the next frame, and as a fraction of a tick it's how far
+// to interpolate between the last two ticks when drawing
+class FixedStep
+{
+	public:
+
+		// Seconds not yet simulated, always less than TICK after advance()
+		double acc = 0;
+
+		// Add a frame of dt seconds and return the number of ticks to run
+		int advance(double dt);
+
+		float alpha() const
+		{
+			return (float) (acc / TICK);
+		}
+};
+
+//========================================================================
+
+#endif
+
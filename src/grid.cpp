@@ -0,0 +1,215 @@
+
+//========================================================================
+//
+// The grid of settled blocks
+//
+//========================================================================
+
+#include <grid.h>
+
+#include <algorithm>
+#include <string.h>
+
+//========================================================================
+
+void Grid::clear()
+{
+	// Mark all blocks as empty
+	for (auto& row: types)
+		row.fill(NTYPES);
+	rows.fill(0);
+	counts.fill(0);
+	heights.fill(0);
+	row_generation.fill(++generation);
+}
+
+//========================================================================
+
+void Grid::set(int ix, int iy, PieceType t)
+{
+	// Set one cell, keeping the bitboard and row counts in sync.  Cells outside
+	// the grid are dropped, e.g. a piece that settles sticking out of the top
+
+	if (ix < 0 || ix >= NX || iy < 0 || iy >= NY) return;
+
+	bool was = types[iy][ix] < NTYPES;
+	bool is  = t < NTYPES;
+	types[iy][ix] = t;
+
+	RowBits bit = (RowBits) 1 << ix;
+	if (is)
+		rows[iy] |= bit;
+	else
+		rows[iy] &= ~bit;
+
+	counts[iy] += is - was;
+	row_generation[iy] = ++generation;
+
+	if (is)
+		heights[ix] = std::max<int>(heights[ix], iy + 1);
+	else if (iy + 1 == heights[ix])
+		heights[ix] = columnTop(ix, iy);
+}
+
+//========================================================================
+
+int Grid::columnTop(int ix, int iy) const
+{
+	RowBits bit = (RowBits) 1 << ix;
+	while (iy > 0 && !(rows[iy - 1] & bit))
+		iy--;
+	return iy;
+}
+
+//========================================================================
+
+LineClear Grid::clearLines(int iylo, int iyhi)
+{
+	// Remove full rows in [iylo, iyhi] and drop everything above them.  Only
+	// the rows touched by the last settled piece can have become full, so
+	// that's all the caller needs to pass.  Checking is just a comparison of
+	// the row counts, and the rows that survive are moved down in contiguous
+	// chunks with memmove
+
+	LineClear lc;
+
+	iylo = std::max(iylo, 0);
+	iyhi = std::min(iyhi, NY - 1);
+	for (int iy = iylo; iy <= iyhi; iy++)
+		if (counts[iy] >= NXFULL)
+			lc.rows[lc.n++] = iy;
+
+	if (lc.n == 0) return lc;
+
+	// Compact.  Chunk k is the run of rows between cleared rows k and k+1 (or
+	// the top of the grid), and it moves down by k+1 rows
+	int dst = lc.rows[0];
+	for (int k = 0; k < lc.n; k++)
+	{
+		int src = lc.rows[k] + 1;
+		int end = k + 1 < lc.n ? lc.rows[k+1] : NY;
+		int len = end - src;
+		if (len <= 0) continue;
+
+		memmove(&types [dst], &types [src], len * sizeof(types [0]));
+		memmove(&rows  [dst], &rows  [src], len * sizeof(rows  [0]));
+		memmove(&counts[dst], &counts[src], len * sizeof(counts[0]));
+		dst += len;
+	}
+
+	// Empty rows enter at the top
+	for (int iy = NY - lc.n; iy < NY; iy++)
+	{
+		types[iy].fill(NTYPES);
+		rows  [iy] = 0;
+		counts[iy] = 0;
+	}
+
+	// Every row from the lowest cleared one up has moved
+	generation++;
+	for (int iy = lc.rows[0]; iy < NY; iy++)
+		row_generation[iy] = generation;
+
+	// Each column had a block in every cleared row, so its top was at least
+	// that high.  If its top block survived, it's now lc.n lower, and if it
+	// was in a cleared row, the new top is somewhere below that
+	for (int ix = 0; ix < NXFULL; ix++)
+		heights[ix] = columnTop(ix, heights[ix] - lc.n);
+
+	return lc;
+}
+
+//========================================================================
+
+void reach(const Board& rows, PieceType t, uint8_t r, int x, int y,
+		bool straddle, Reach& out)
+{
+	// Breadth first over poses, each one a rotation state and the min corner
+	// cell of its bounding box.  The walls and floor keep ix and iy >= 0, and
+	// the piece never goes down, so every pose fits in the seen table
+
+	for (auto& a: out.iy)
+		a.fill(NOREACH);
+
+	struct Pose
+	{
+		uint8_t r;
+		int8_t ix, iy;
+	};
+	const int NPOSES = NROT * NXFULL * NYREACH;
+	uint8_t seen[NPOSES] = {};
+	Pose queue[NPOSES];
+	int head = 0, tail = 0;
+
+	auto ok = [&](const Rotation& rot, int ix, int iy)
+	{
+		return fits(rows, rot, ix, iy)
+			&& (!straddle || fits(rows, rot, ix, iy - 1));
+	};
+
+	auto visit = [&](uint8_t r, int ix, int iy)
+	{
+		if (iy >= NYREACH) return;
+
+		int i = (r * NXFULL + ix) * NYREACH + iy;
+		if (seen[i]) return;
+		seen[i] = 1;
+
+		queue[tail++] = {r, (int8_t) ix, (int8_t) iy};
+		if (out.iy[r][ix] == NOREACH) out.iy[r][ix] = (int8_t) iy;
+	};
+
+	const Rotation& rot0 = ROTATIONS[t][r];
+	if (!ok(rot0, x + rot0.xmin, y + rot0.ymin)) return;
+	visit(r, x + rot0.xmin, y + rot0.ymin);
+
+	while (head < tail)
+	{
+		Pose p = queue[head++];
+		const Rotation& rot = ROTATIONS[t][p.r];
+
+		for (int dx: {-1, 1})
+			if (ok(rot, p.ix + dx, p.iy))
+				visit(p.r, p.ix + dx, p.iy);
+
+		// Turn each way with the first kick that fits, from the origin
+		int ox = p.ix - rot.xmin, oy = p.iy - rot.ymin;
+		for (int dr: {1, -1})
+		{
+			uint8_t r1 = (p.r + NROT + dr) % NROT;
+			const Rotation& to = ROTATIONS[t][r1];
+			const Kicks& kicks = KICKS[t][p.r][dr > 0 ? 0 : 1];
+			for (int k = 0; k < NKICKS; k++)
+			{
+				int ix = ox + kicks[k].dx + to.xmin;
+				int iy = oy + kicks[k].dy + to.ymin;
+				if (ok(to, ix, iy))
+				{
+					visit(r1, ix, iy);
+					break;
+				}
+			}
+		}
+	}
+}
+
+//========================================================================
+
+int Grid::landRow(const Rotation& rot, int ix, int iy) const
+{
+	// Where the piece meets the top of the column that stops it first, in one
+	// pass over its width, instead of stepping it down a row at a time.  That
+	// only works if the piece is above every column it covers.  Under an
+	// overhang, e.g. after sliding in under one, there's no telling from the
+	// heights what's below, so step down instead
+
+	int land = 0;
+	for (int j = 0; j <= rot.xmax - rot.xmin; j++)
+		land = std::max(land, heights[ix + j] - rot.colbottom[j]);
+
+	if (land <= iy) return land;
+	return dropRow(rows, rot, ix, iy);
+}
+
+//========================================================================
+
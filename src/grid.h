@@ -0,0 +1,189 @@
+
+//========================================================================
+//
+// The grid of settled blocks
+//
+//========================================================================
+
+#ifndef TETRIS_GRID_H
+#define TETRIS_GRID_H
+
+#include <array>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+ #include <intrin.h>
+#endif
+
+#include <piece.h>
+
+//========================================================================
+
+// Tetris world size, in [-WXH, WXH] x [-WY, 0].  TODO: these should be ints
+const float WX = 20.0f, WY = 30.0f;
+const float WXH = 0.5f * WX;
+
+const float XMIN = -WXH, XMAX = WXH, YMIN = -WY, YMAX = 0;
+
+// Number of cells (not points)
+const int NX = (int) (XMAX - XMIN + 1);
+const int NY = (int) (YMAX - YMIN + 1);
+//constexpr int NX = (int) ceil(XMAX - XMIN);  // ceil is not compile-time const?
+//constexpr int NY = (int) ceil(YMAX - YMIN);
+
+// Number of columns that pieces can actually reach.  The last of the NX
+// columns is never filled, so a row is full when it has this many blocks
+const int NXFULL = (int) WX;
+
+// One bitboard word per grid row.  Bit ix is column ix
+typedef uint64_t RowBits;
+static_assert(NX <= 64, "grid rows don't fit in a RowBits word");
+
+// Just the occupancy bits of a grid, cheap to copy for searching placements
+typedef std::array<RowBits, NY> Board;
+
+// Bits of the columns that pieces can reach
+const RowBits FULLROW = ((RowBits) 1 << NXFULL) - 1;
+
+inline int popcount(RowBits b)
+{
+#if defined(_MSC_VER)
+	return (int) __popcnt64(b);
+#else
+	return __builtin_popcountll(b);
+#endif
+}
+
+inline int ctz(RowBits b)
+{
+	// Index of the lowest set bit.  b must not be 0
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward64(&i, b);
+	return (int) i;
+#else
+	return __builtin_ctzll(b);
+#endif
+}
+
+// Rows removed by one call to Grid::clearLines(), so that scoring and
+// rendering can react without rescanning the grid
+struct LineClear
+{
+	// Number of rows cleared, at most one per block of the settled piece
+	int n = 0;
+
+	// Indices of the cleared rows before compaction, ascending
+	int rows[NBLOCKS] = {};
+};
+
+//========================================================================
+
+class Grid
+{
+	public:
+
+		// Piece type of each settled block, or NTYPES for an empty cell.
+		// Row-major, i.e. types[iy][ix], so that clearing lines can move
+		// whole rows at once
+		std::array<std::array<PieceType, NX>, NY> types;
+
+		// Occupancy bitboard kept alongside types.  Bit ix of rows[iy] is set
+		// iff types[iy][ix] < NTYPES
+		Board rows;
+
+		// Number of blocks in each row
+		std::array<uint8_t, NY> counts;
+
+		// Height of each column:  one more than the row of its top block, or
+		// 0 if it's empty.  Kept up to date as blocks are set and lines clear
+		std::array<uint8_t, NX> heights;
+
+		// Bumped on every change, so that renderers can tell when their copy
+		// of the blocks is stale
+		uint64_t generation = 0;
+
+		// Generation of the last change to each row, so that only the rows
+		// that changed need to be rebuilt
+		std::array<uint64_t, NY> row_generation = {};
+
+		void clear();
+		void set(int ix, int iy, PieceType t);
+		LineClear clearLines(int iylo, int iyhi);
+
+		// Row that a piece which fits with its bounding box min corner in
+		// cell (ix, iy) comes to rest on if it drops straight down
+		int landRow(const Rotation& rot, int ix, int iy) const;
+
+		PieceType get(int ix, int iy) const
+		{
+			return types[iy][ix];
+		}
+
+	private:
+
+		// Height of column ix, given that nothing in it is at row iy or above
+		int columnTop(int ix, int iy) const;
+};
+
+//========================================================================
+
+inline bool fits(const Board& rows, const Rotation& rot, int ix, int iy)
+{
+	// Exact integer test for a piece with its bounding box min corner in cell
+	// (ix, iy), including the walls and floor.  Rows above the grid are empty
+
+	if (ix < 0 || ix + rot.xmax - rot.xmin >= NXFULL || iy < 0) return false;
+
+	for (int k = 0; k <= rot.ymax - rot.ymin && iy + k < NY; k++)
+		if (((RowBits) rot.rowbits[k] << ix) & rows[iy + k]) return false;
+
+	return true;
+}
+
+inline int dropRow(const Board& rows, const Rotation& rot, int ix, int iy)
+{
+	// Lowest row that a piece which fits at row iy can fall to
+	while (fits(rows, rot, ix, iy - 1)) iy--;
+	return iy;
+}
+
+inline int kick(const Board& rows, PieceType t, uint8_t r, int dr, int x, int y)
+{
+	// Index of the first kick that lets a piece of type t with its origin in
+	// cell (x, y) turn out of rotation state r, CCW for dr > 0 or CW for
+	// dr < 0, or -1 if none does.  The same test as Game::rotate() makes for
+	// a piece on a whole row, without a Game, for searches
+	const Rotation& to = ROTATIONS[t][(r + NROT + dr) % NROT];
+	const Kicks& kicks = KICKS[t][r][dr > 0 ? 0 : 1];
+	for (int k = 0; k < NKICKS; k++)
+		if (fits(rows, to, x + kicks[k].dx + to.xmin, y + kicks[k].dy + to.ymin))
+			return k;
+	return -1;
+}
+
+// Rows that a reach() search goes up to, above the bottom of the grid.  Kicks
+// can lift a piece a little above the top row, but no further
+const int NYREACH = NY + NBLOCKS;
+
+const int8_t NOREACH = -1;
+
+// Where a piece can get to by moving sideways and turning, with the same
+// kicks as Game::rotate(), without moving down.  For each rotation state and
+// bounding box min column, the bounding box min row of the first pose found
+// there, breadth first, or NOREACH
+struct Reach
+{
+	std::array<std::array<int8_t, NXFULL>, NROT> iy;
+};
+
+// Search from a piece of type t in rotation state r with its origin in cell
+// (x, y).  With straddle, the piece is part way down to the row below, and
+// every pose needs that row free too
+void reach(const Board& rows, PieceType t, uint8_t r, int x, int y,
+		bool straddle, Reach& out);
+
+//========================================================================
+
+#endif
+
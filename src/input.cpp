@@ -0,0 +1,91 @@
+
+//========================================================================
+//
+// Keyboard input
+//
+//========================================================================
+
+#include <input.h>
+
+//========================================================================
+
+void KeyRepeater::press(Key key, Game& game)
+{
+	switch (key)
+	{
+		case KEY_LEFT : game.apply({CMD_LEFT }); break;
+		case KEY_RIGHT: game.apply({CMD_RIGHT}); break;
+		case KEY_DOWN : game.apply({CMD_DOWN }); break;
+		case KEY_CCW  : game.apply({CMD_CCW  }); break;
+		case KEY_CW   : game.apply({CMD_CW   }); break;
+		case KEY_DROP : game.apply({CMD_DROP }); break;
+		default: break;
+	}
+}
+
+//========================================================================
+
+void KeyRepeater::update(double t, Game& game)
+{
+	// At most the shift key and the down key repeat, so pick whichever is due
+	// first until neither is
+
+	for (;;)
+	{
+		Key k = NKEYS;
+		if (shift != NKEYS && next[shift] <= t)
+			k = shift;
+		if (held[KEY_DOWN] && next[KEY_DOWN] <= t
+				&& (k == NKEYS || next[KEY_DOWN] < next[k]))
+			k = KEY_DOWN;
+
+		if (k == NKEYS) return;
+
+		press(k, game);
+		next[k] += k == KEY_DOWN ? sdr : arr;
+	}
+}
+
+//========================================================================
+
+void KeyRepeater::event(const InputEvent& e, Game& game)
+{
+	if (e.key >= NKEYS || held[e.key] == e.down) return;
+	held[e.key] = e.down;
+
+	bool horizontal = e.key == KEY_LEFT || e.key == KEY_RIGHT;
+	if (e.down)
+	{
+		press(e.key, game);
+
+		if (horizontal)
+		{
+			shift = e.key;
+			next[e.key] = e.t + das;
+		}
+		else if (e.key == KEY_DOWN)
+			next[e.key] = e.t + sdr;
+	}
+	else if (e.key == shift)
+	{
+		// Fall back to the other direction if it's still held, starting its
+		// delay over
+		Key other = shift == KEY_LEFT ? KEY_RIGHT : KEY_LEFT;
+		shift = NKEYS;
+		if (held[other])
+		{
+			shift = other;
+			next[other] = e.t + das;
+		}
+	}
+}
+
+//========================================================================
+
+void KeyRepeater::reset()
+{
+	held.fill(false);
+	shift = NKEYS;
+}
+
+//========================================================================
@@ -0,0 +1,77 @@
+
+//========================================================================
+//
+// Keyboard input for the game:  timestamped key events, and our own
+// hold/release state and key repeat instead of the OS's.  Nothing in here
+// touches GLFW, so the same events can be fed in from anywhere
+//
+//========================================================================
+
+#ifndef TETRIS_INPUT_H
+#define TETRIS_INPUT_H
+
+#include <array>
+#include <stdint.h>
+
+#include <game.h>
+
+//========================================================================
+
+// Keys that the game cares about
+enum Key : uint8_t
+{
+	KEY_LEFT, KEY_RIGHT, KEY_DOWN, KEY_CCW, KEY_CW, KEY_DROP, KEY_AI, KEY_REPLAY,
+	NKEYS
+};
+
+// A key going down or up at time t, in seconds by steadyTime()
+struct InputEvent
+{
+	double t = 0;
+	Key key = NKEYS;
+	bool down = false;
+};
+
+//========================================================================
+
+// Turns key presses and releases into moves.  Left and right move once when
+// pressed, and then, if still held, again after das and every arr after that.
+// Down repeats every sdr with no delay, and nothing else repeats.  Repeats are
+// scheduled from the press time rather than counted in ticks, so they land at
+// the same times however the ticks fall, and more than one can land in a tick
+class KeyRepeater
+{
+	public:
+
+		// Delayed auto shift, auto repeat rate, and soft drop repeat rate,
+		// in seconds
+		double das = 0.133, arr = 0.033, sdr = 0.033;
+
+		// Apply every repeat that's due by time t, in order
+		void update(double t, Game& game);
+
+		// Apply one key event.  Call update(e.t) first, so that repeats from
+		// before the event come before it
+		void event(const InputEvent& e, Game& game);
+
+		// Let go of every key without moving, e.g. when the game pauses
+		void reset();
+
+	private:
+
+		std::array<bool, NKEYS> held = {};
+
+		// Time of the next repeat of each held key
+		std::array<double, NKEYS> next = {};
+
+		// The horizontal key that's repeating.  If both are held, it's the
+		// one pressed last
+		Key shift = NKEYS;
+
+		void press(Key key, Game& game);
+};
+
+//========================================================================
+
+#endif
+
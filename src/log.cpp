@@ -0,0 +1,348 @@
+
+//========================================================================
+//
+// Logging
+//
+//========================================================================
+
+#include <log.h>
+
+// Standard
+#include <algorithm>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+// 3P
+#include <fmt/format.h>
+
+//========================================================================
+
+std::string me = "Tetris";
+
+std::atomic<bool> quiet{false};
+
+//========================================================================
+
+namespace
+{
+
+const int MAX_FIELDS = 6;
+
+// Preformatted text up to this long is copied into the queue, and anything
+// longer goes on the heap
+const size_t TEXT_SIZE = 200;
+
+// Queue length.  Must be a power of 2
+const size_t NSLOTS = 1024;
+
+// One queued message:  either msg and fields, or text, or a flush marker
+struct Record
+{
+	LogLevel level = LOG_INFO;
+	const char* msg = nullptr;
+	int nfields = 0;
+	LogField fields[MAX_FIELDS];
+	char text[TEXT_SIZE];
+	std::string* big = nullptr;
+	std::promise<void>* flushed = nullptr;
+};
+
+// Bounded queue for any number of producers and one consumer.  Each slot has
+// a sequence number that says whose turn it is:  a producer may fill slot
+// pos % NSLOTS when its sequence is pos, and the consumer may read it when
+// it's pos + 1
+struct Slot
+{
+	std::atomic<size_t> seq;
+	Record rec;
+};
+
+class Logger
+{
+	public:
+
+		std::atomic<std::FILE*> out{stdout}, err{stderr};
+
+		// Messages that didn't fit in the queue
+		std::atomic<int64_t> dropped{0};
+
+		Logger() : slots(new Slot[NSLOTS])
+		{
+			for (size_t i = 0; i < NSLOTS; i++)
+				slots[i].seq = i;
+			thread = std::thread(&Logger::drain, this);
+		}
+
+		~Logger()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m);
+				stopping = true;
+			}
+			cv.notify_one();
+			thread.join();
+		}
+
+		// Reserve a slot, or return nullptr if the queue is full.  Fill it in
+		// and then call publish()
+		Record* reserve(size_t& pos)
+		{
+			pos = head.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				Slot& s = slots[pos & (NSLOTS - 1)];
+				size_t seq = s.seq.load(std::memory_order_acquire);
+				if (seq == pos)
+				{
+					if (head.compare_exchange_weak(pos, pos + 1,
+							std::memory_order_relaxed))
+						return &s.rec;
+				}
+				else if (seq < pos)
+					return nullptr;
+				else
+					pos = head.load(std::memory_order_relaxed);
+			}
+		}
+
+		// Like reserve(), but wait for room instead of giving up.  For
+		// messages that can't be dropped
+		Record* reserveWait(size_t& pos)
+		{
+			Record* r;
+			while (!(r = reserve(pos)))
+				std::this_thread::yield();
+			return r;
+		}
+
+		void publish(size_t pos)
+		{
+			slots[pos & (NSLOTS - 1)].seq.store(pos + 1,
+					std::memory_order_release);
+
+			// Only wake the consumer if it's gone to sleep.  The fence pairs
+			// with the one in drain(), so that either it sees this message
+			// or this sees it sleeping
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (sleeping.load(std::memory_order_relaxed)
+					&& sleeping.exchange(false))
+			{
+				std::lock_guard<std::mutex> lock(m);
+				cv.notify_one();
+			}
+		}
+
+	private:
+
+		std::unique_ptr<Slot[]> slots;
+		alignas(64) std::atomic<size_t> head{0};
+		alignas(64) size_t tail = 0;
+
+		std::thread thread;
+		std::mutex m;
+		std::condition_variable cv;
+		std::atomic<bool> sleeping{false};
+		bool stopping = false;
+
+		bool ready() const
+		{
+			return slots[tail & (NSLOTS - 1)].seq.load(std::memory_order_acquire)
+				== tail + 1;
+		}
+
+		void write(Record& r);
+		void drain();
+};
+
+//========================================================================
+
+Logger& logger()
+{
+	// Started by the first message
+	static Logger l;
+	return l;
+}
+
+//========================================================================
+
+void Logger::write(Record& r)
+{
+	fmt::memory_buffer buf;
+	fmt::format_to(std::back_inserter(buf), "{}: ", me);
+
+	if (r.msg)
+	{
+		fmt::format_to(std::back_inserter(buf), "{}", r.msg);
+		for (int i = 0; i < r.nfields; i++)
+		{
+			const LogField& f = r.fields[i];
+			switch (f.type)
+			{
+				case LogField::INT  : fmt::format_to(std::back_inserter(buf), " {}={}", f.key, f.i); break;
+				case LogField::FLOAT: fmt::format_to(std::back_inserter(buf), " {}={}", f.key, f.f); break;
+				case LogField::STR  : fmt::format_to(std::back_inserter(buf), " {}={}", f.key, f.s); break;
+			}
+		}
+	}
+	else if (r.big)
+	{
+		buf.append(r.big->data(), r.big->data() + r.big->size());
+		delete r.big;
+		r.big = nullptr;
+	}
+	else
+		buf.append(r.text, r.text + strlen(r.text));
+
+	buf.push_back('\n');
+
+	std::FILE* f = r.level >= LOG_WARN ? err.load() : out.load();
+	fwrite(buf.data(), 1, buf.size(), f);
+}
+
+//========================================================================
+
+void Logger::drain()
+{
+	for (;;)
+	{
+		bool wrote = false;
+		while (ready())
+		{
+			Record& r = slots[tail & (NSLOTS - 1)].rec;
+			std::promise<void>* flushed = r.flushed;
+			r.flushed = nullptr;
+
+			if (!flushed)
+			{
+				write(r);
+				wrote = true;
+			}
+
+			slots[tail & (NSLOTS - 1)].seq.store(tail + NSLOTS,
+					std::memory_order_release);
+			tail++;
+
+			if (flushed)
+			{
+				fflush(out);
+				fflush(err);
+				flushed->set_value();
+			}
+		}
+
+		int64_t n = dropped.exchange(0);
+		if (n > 0)
+		{
+			fmt::print(err, "{}: dropped {} log message(s), the queue was full\n",
+					me, n);
+			wrote = true;
+		}
+
+		// One fflush per batch instead of one per message
+		if (wrote)
+		{
+			fflush(out);
+			fflush(err);
+		}
+
+		std::unique_lock<std::mutex> lock(m);
+		if (stopping && !ready()) return;
+
+		sleeping = true;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (ready())
+		{
+			sleeping = false;
+			continue;
+		}
+		cv.wait(lock, [this]{ return !sleeping || stopping; });
+		sleeping = false;
+	}
+}
+
+}
+
+//========================================================================
+
+void logPush(LogLevel level, const char* msg,
+		std::initializer_list<LogField> fields)
+{
+	if (level < LOG_WARN && quiet.load(std::memory_order_relaxed)) return;
+
+	Logger& l = logger();
+	size_t pos;
+	Record* r = level >= LOG_WARN ? l.reserveWait(pos) : l.reserve(pos);
+	if (!r)
+	{
+		l.dropped++;
+		return;
+	}
+
+	r->level = level;
+	r->msg = msg;
+	r->nfields = (int) std::min(fields.size(), (size_t) MAX_FIELDS);
+	std::copy(fields.begin(), fields.begin() + r->nfields, r->fields);
+	l.publish(pos);
+}
+
+//========================================================================
+
+void logPush(LogLevel level, const std::string& str)
+{
+	if (level < LOG_WARN && quiet.load(std::memory_order_relaxed)) return;
+
+	Logger& l = logger();
+	size_t pos;
+	Record* r = level >= LOG_WARN ? l.reserveWait(pos) : l.reserve(pos);
+	if (!r)
+	{
+		l.dropped++;
+		return;
+	}
+
+	r->level = level;
+	r->msg = nullptr;
+	if (str.size() < TEXT_SIZE)
+		memcpy(r->text, str.c_str(), str.size() + 1);
+	else
+		r->big = new std::string(str);
+	l.publish(pos);
+}
+
+//========================================================================
+
+void logerr(const std::string& str)
+{
+	logPush(LOG_ERROR, str);
+	logFlush();
+}
+
+//========================================================================
+
+void logFlush()
+{
+	Logger& l = logger();
+	std::promise<void> flushed;
+	size_t pos;
+	Record* r = l.reserveWait(pos);
+	r->flushed = &flushed;
+	l.publish(pos);
+	flushed.get_future().wait();
+}
+
+//========================================================================
+
+void logOutput(std::FILE* out, std::FILE* err)
+{
+	Logger& l = logger();
+	logFlush();
+	l.out = out;
+	l.err = err;
+}
+
+//========================================================================
+
@@ -0,0 +1,106 @@
+
+//========================================================================
+//
+// Logging.  Messages go into a lock-free ring buffer and a background thread
+// formats and writes them, so logging from a hot path costs a few stores
+// instead of a format, a string concatenation and an fflush.  Levels below
+// TETRIS_LOG_LEVEL are compiled out altogether
+//
+//========================================================================
+
+#ifndef TETRIS_LOG_H
+#define TETRIS_LOG_H
+
+#include <atomic>
+#include <initializer_list>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <type_traits>
+
+//========================================================================
+
+enum LogLevel
+{
+	LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR
+};
+
+// Lowest level that's compiled in.  Set by cmake
+#ifndef TETRIS_LOG_LEVEL
+#define TETRIS_LOG_LEVEL LOG_INFO
+#endif
+
+// Program name, prefixed to every log message.  Set it before the first log
+extern std::string me;
+
+// Suppress everything below LOG_WARN, e.g. for headless batch runs where the
+// per-piece messages would swamp everything else
+extern std::atomic<bool> quiet;
+
+// One key=value pair of a structured message.  Keys, and string values, are
+// kept by pointer until the message is written, so they have to be literals
+// or otherwise live for the whole program
+struct LogField
+{
+	enum Type : uint8_t {INT, FLOAT, STR};
+
+	const char* key;
+	Type type;
+	union
+	{
+		int64_t i;
+		double f;
+		const char* s;
+	};
+
+	LogField() : key(nullptr), type(INT), i(0) {}
+
+	template <typename T, typename std::enable_if<
+			std::is_integral<T>::value || std::is_enum<T>::value, int>::type = 0>
+	LogField(const char* k, T v) : key(k), type(INT), i((int64_t) v) {}
+
+	LogField(const char* k, double v) : key(k), type(FLOAT), f(v) {}
+	LogField(const char* k, const char* v) : key(k), type(STR), s(v) {}
+};
+
+// Queue a message.  Use log(), logerr() or logAt() instead
+void logPush(LogLevel level, const char* msg,
+		std::initializer_list<LogField> fields);
+void logPush(LogLevel level, const std::string& str);
+
+// A structured message, written as "msg key=value key=value ...".  msg has
+// the same lifetime rule as the keys.  Nothing is formatted on the calling
+// thread, and if L is compiled out the call is gone entirely, e.g.
+//
+//     logAt<LOG_DEBUG>("cleared lines", {{"n", n}, {"total", lines}});
+//
+template <LogLevel L>
+inline void logAt(const char* msg, std::initializer_list<LogField> fields = {})
+{
+	if constexpr (L >= TETRIS_LOG_LEVEL)
+		logPush(L, msg, fields);
+}
+
+// Preformatted messages, copied into the queue.  For everything that isn't
+// on a hot path.  log() is at LOG_INFO, and compiled out along with it, so
+// one TETRIS_LOG_LEVEL controls every message.  Errors wait until they've
+// been written, in case the program is about to go down
+inline void log(const std::string& str)
+{
+	if constexpr (LOG_INFO >= TETRIS_LOG_LEVEL)
+		logPush(LOG_INFO, str);
+}
+
+void logerr(const std::string& str);
+
+// Wait until everything queued so far has been written
+void logFlush();
+
+// Where messages go:  below LOG_WARN to out and the rest to err.  stdout and
+// stderr by default
+void logOutput(std::FILE* out, std::FILE* err);
+
+//========================================================================
+
+#endif
+
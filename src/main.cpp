@@ -23,11 +23,15 @@
 //****************
 
 // Standard
+#include <algorithm>
 #include <array>
-#include <limits>
+#include <atomic>
+#include <condition_variable>
 #include <math.h>
+#include <mutex>
 #include <stdlib.h>
 #include <string>
+#include <thread>
 #include <time.h>
 #include <vector>
 
@@ -35,54 +39,120 @@
 #include <fmt/core.h>
 #include <lodepng.h>
 
+// Tetris
+#include <ai.h>
+#include <game.h>
+#include <log.h>
+#include <pool.h>
+#include <profile.h>
+#include <render.h>
+#include <simthread.h>
+#include <texload.h>
+
 //========================================================================
 // Global variables
 //========================================================================
 
 // OpenGL related
+//
+// There are 3 threads:  the main thread handles window events, the render
+// thread owns the GL context and draws, and the game ticks on its own thread
+// inside SimThread.  Globals shared between them are atomic
 
 // Mouse position
 double xpos = 0, ypos = 0;
 
 // Window size
-int width, height;
+std::atomic<int> width{1}, height{1};
 
 // Active view: 0 = none, 1 = upper left, 2 = upper right, 3 = lower left,
 // 4 = lower right.  TODO: obsolete
 int active_view = 0;
 
 // Rotation around each axis
-int rot_x = 0, rot_y = 0, rot_z = 0;
+std::atomic<int> rot_x{0}, rot_y{0}, rot_z{0};
 
-// Times
-double t0, t, dt;
+// Set by the main thread to stop the render thread
+std::atomic<bool> quit{false};
 
-//****************
+// Window state, which decides how hard the render thread works
+std::atomic<bool> focused{true}, iconified{false};
 
-// Non-OpenGL
+// P pauses the game
+bool player_paused = false;
+
+// How the render thread paces itself.  See renderLoop()
+enum RenderMode {ACTIVE, BACKGROUND, IDLE, NMODES};
+const char* MODE_NAMES[NMODES] = {"active", "background", "idle"};
+
+// Frame rate cap while the window doesn't have focus
+const double BACKGROUND_FPS = 30;
+
+// Wakes the render thread when there's something new to draw:  a snapshot,
+// or a change to the window or the settings
+struct Redraw
+{
+	std::mutex m;
+	std::condition_variable cv;
+	bool pending = true;
+
+	void request()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			pending = true;
+		}
+		cv.notify_one();
+	}
 
-std::string me = "Tetris";
+	// Clear the request, and return whether there was one
+	bool take()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		bool p = pending;
+		pending = false;
+		return p;
+	}
 
-// Tetris world size, in [-WXH, WXH] x [-WY, 0].  TODO: these should be ints
-const float WX = 20.0f, WY = 30.0f;
-const float WXH = 0.5f * WX;
+	// Wait until there's a request, or for secs at most
+	void wait(double secs)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		cv.wait_for(lock, std::chrono::duration<double>(secs),
+				[this]{ return pending; });
+	}
+} redraw;
+
+// Settled blocks are drawn with one instanced call when GL 3.3 is available,
+// and they and the grid lines are cached on the GPU.  I toggles back to the
+// immediate mode path for comparison
+BoardRenderer renderer;
+std::atomic<bool> enable_instancing{true};
+
+// V toggles vsync, so that frame times aren't pinned to the refresh rate
+std::atomic<bool> vsync{true};
+
+// Frame time stats, logged every few seconds
+struct FrameStats
+{
+	double t0 = 0, draw = 0;
+	int n = 0;
 
-const float XMIN = -WXH, XMAX = WXH, YMIN = -WY, YMAX = 0;
+	// Input latency:  time from a key event to the swap of the first frame
+	// that shows it, summed over nlatency events, and the worst of them
+	double latency = 0, latency_max = 0;
+	int nlatency = 0;
 
-// Number of cells (not points)
-const int NX = (int) (XMAX - XMIN + 1);
-const int NY = (int) (YMAX - YMIN + 1);
-//constexpr int NX = (int) ceil(XMAX - XMIN);  // ceil is not compile-time const?
-//constexpr int NY = (int) ceil(YMAX - YMIN);
+	// Time of the newest key event that's been shown
+	double input_t = 0;
+} frame_stats;
 
-const uint8_t NROT = 4;
-const float ROTDEG = 360.f / NROT;
+//****************
 
-// Downward piece speed, units per second
-float speed = 5.f;//0.5f;
+// Non-OpenGL
 
-// Active piece index
-int64_t ip = -1;
+// The game and its autoplayer, which A toggles
+SimThread sim;
 
 //****************
 
@@ -92,9 +162,6 @@ bool enable_texture = !true;
 const unsigned F_TEX_WIDTH  = 16;  // Floor texture dimensions
 const unsigned F_TEX_HEIGHT = 16;
 
-// Texture object IDs
-std::vector<GLuint> tex_ids;
-
 // TODO: check that this is at least as big as PieceType
 const std::vector<std::string> TEX_FILES =
 {
@@ -111,18 +178,18 @@ const std::vector<std::string> TEX_FILES =
 	"res/textures/hptt/Dirt_01_2048.png"
 };
 
-//========================================================================
+// Decoded mip chains of TEX_FILES, so that only the first run pays for
+// decoding.  The build dir is as good a place as any, since it's not in git
+const std::string TEX_CACHE = "build/texcache";
 
-void log(const std::string& str, std::FILE* f = stdout)
-{
-	fmt::print(f, me + ": " + str + "\n");
-	fflush(f);
-}
+// GPU memory cap for all piece textures together.  The full 2048 mip chains
+// would be ~22 MB each, but at this camera distance a block only covers a few
+// dozen pixels, so the budget rarely matters
+const size_t TEX_BUDGET = 32 << 20;
 
-void logerr(const std::string& str)
-{
-	log(str, stderr);
-}
+// Vertical field of view, and distance from the eye to the board
+const float FOVY  = 65.f * (float) M_PI / 180.f;
+const float EYE_Z = 0.95f * WY;
 
 //========================================================================
 
@@ -132,14 +199,6 @@ void drawBlock()
 	//
 	// TODO: load an asset with rounded corners?
 
-	// Hack z-fighting by drawing blocks slightly smaller than 1 unit.  It's
-	// noticeble on blocks in single pieces, not just neighboring pieces.
-	float u = 0.95f; //1;
-	float z = 1 - u;
-
-	// Texture max (1 for full texture on every face)
-	float t = 0.5f;
-
 	static GLuint block_list = 0;
 	if (!block_list)
 	{
@@ -150,78 +209,16 @@ void drawBlock()
 		//glBegin(GL_QUAD_STRIP);
 		glBegin(GL_QUADS);
 
-			// Both the CW/CCW ordering of vertices and the normal are
-			// important.  The CW ordering determines backface culling, while
-			// the normal determines lighting
-
 			// TODO: wrap texture coords around block instead of using full 0,1
 			// range on each face
 
-			// quad 1
-			glNormal3f( 1,  0,  0);
-			glTexCoord2f(0, t);
-			glVertex3f(u, z, u);
-			glTexCoord2f(t, t);
-			glVertex3f(u, u, u);
-			glTexCoord2f(t, 0);
-			glVertex3f(u, u, z);
-			glTexCoord2f(0, 0);
-			glVertex3f(u, z, z);
-
-			// quad 2
-			glNormal3f( 0,  0,  1);
-			glTexCoord2f(0, t);
-			glVertex3f(z, u, u);
-			glTexCoord2f(t, t);
-			glVertex3f(u, u, u);
-			glTexCoord2f(t, 0);
-			glVertex3f(u, z, u);
-			glTexCoord2f(0, 0);
-			glVertex3f(z, z, u);
-
-			// quad 3
-			glNormal3f(-1,  0,  0);
-			glTexCoord2f(0, t);
-			glVertex3f(z, z, z);
-			glTexCoord2f(t, t);
-			glVertex3f(z, u, z);
-			glTexCoord2f(t, 0);
-			glVertex3f(z, u, u);
-			glTexCoord2f(0, 0);
-			glVertex3f(z, z, u);
-
-			// quad 4
-			glNormal3f( 0,  0, -1);
-			glTexCoord2f(0, t);
-			glVertex3f(z, z, z);
-			glTexCoord2f(t, t);
-			glVertex3f(u, z, z);
-			glTexCoord2f(t, 0);
-			glVertex3f(u, u, z);
-			glTexCoord2f(0, 0);
-			glVertex3f(z, u, z);
-
-			// quad 5
-			glNormal3f( 0,  1,  0);
-			glTexCoord2f(0, t);
-			glVertex3f(u, u, z);
-			glTexCoord2f(t, t);
-			glVertex3f(u, u, u);
-			glTexCoord2f(t, 0);
-			glVertex3f(z, u, u);
-			glTexCoord2f(0, 0);
-			glVertex3f(z, u, z);
-
-			// quad 6
-			glNormal3f( 0, -1,  0);
-			glTexCoord2f(0, t);
-			glVertex3f(z, z, z);
-			glTexCoord2f(t, t);
-			glVertex3f(z, z, u);
-			glTexCoord2f(t, 0);
-			glVertex3f(u, z, u);
-			glTexCoord2f(0, 0);
-			glVertex3f(u, z, z);
+			// The instanced renderer draws the same vertices
+			for (auto& v: CUBE)
+			{
+				glNormal3f(v.nx, v.ny, v.nz);
+				glTexCoord2f(v.s, v.t);
+				glVertex3f(v.x, v.y, v.z);
+			}
 
 		glEnd();
 
@@ -237,59 +234,6 @@ void drawBlock()
 
 //========================================================================
 
-// Tetris pieces are shaped (roughly) like these letters.  G is like uppercase
-// gamma (reverse L).
-enum PieceType {I, L, O, S, G, Z, T, NTYPES};
-
-// Define each piece in terms of an array of xy translations of each block
-// relative to the piece's center.  Order of vector components must be the same
-// as in the PieceType enum.
-const std::vector< std::vector<float> > BLOCKS =
-	{
-		{ // I
-			-0.5, -2,
-			-0.5, -1,
-			-0.5,  0,
-			-0.5,  1
-		},
-		{ // L
-			-1,  0.5,
-			-1, -0.5,
-			-1, -1.5,
-			 0, -1.5
-		},
-		{ // O
-			 0,  0,
-			-1,  0,
-			-1, -1,
-			 0, -1
-		},
-		{ // S
-			-1.5, -1,
-			-0.5, -1,
-			-0.5,  0,
-			 0.5,  0
-		},
-		{ // G (L mirror)
-			 0,  0.5,
-			 0, -0.5,
-			 0, -1.5,
-			-1, -1.5
-		},
-		{ // Z (S mirror)
-			 0.5, -1,
-			-0.5, -1,
-			-0.5,  0,
-			-1.5,  0
-		},
-		{ // T
-			-1.5, -1,
-			-0.5, -1,
-			 0.5, -1,
-			-0.5,  0
-		}
-	};
-
 const std::vector< std::vector<GLfloat> > COLORS =
 	{
 
@@ -328,464 +272,105 @@ const std::vector< std::vector<GLfloat> > COLORS =
 
 //========================================================================
 
-class Piece
-{
-	public:
-		float x, y;     // center position
-		float  sx = 0;  // snap displacement (0 or 0.5)
-		uint8_t r = 0;  // rotation state in [0, 3]
-		PieceType t;
-
-		void decompose();
-		void move(float dx, float dy, bool key_initiated);
-		void getBlock(int i, float& bx, float& by);
-		void getMin(float& xmin, float& ymin);
-		std::vector<float> getCenters();
-		void snapx();
-};
-
-//std::vector<Piece> pieces;
-Piece piece;
-
-void newPiece()
+void drawPiece(const std::array<float, 2 * NBLOCKS>& b)
 {
-	log("Starting newPiece()");
-	Piece p;
-
-	p.x = 0;
-	p.y = 0;
-	p.r = rand() % NROT;
-	p.t = static_cast<PieceType>(rand() % NTYPES);
-
-	p.snapx();
-
-	//pieces.push_back(p);
-	piece = p;
-
-	ip++; // TODO unused
-
-	//log(fmt::format("ip = {}", ip));
-}
-
-//========================================================================
-
-void mat4x4gl_mul_vec4(vec4 r, GLfloat* const M, vec4 const v)
-{
-	// mat4x4_mul_vec4 takes mat4x4, and it's easier to re-implement with
-	// GLfloat* than casting or copying
-	//
-	// TODO: consider adding glm dependency or some other lib?
-	int i, j;
-	for(j=0; j<4; ++j) {
-		r[j] = 0.f;
-		for(i=0; i<4; ++i)
-			r[j] += M[4*i+j] * v[i];
-	}
-}
-
-//========================================================================
-
-std::array<std::array<PieceType, NY>, NX> blocks;
-
-void Piece::decompose()
-{
-	// TODO: edit comment
-	//
-	// Decompose a piece into individual blocks and push them to a vec.  When
-	// lines are eliminated later, individual blocks will have to be treated
-	// instead of whole pieces.  Don't use a vector of pieces at all, since
-	// there will only ever be 1 active piece.  The only thing that needs
-	// a vector is settled blocks.
-	//
-	// Use an NX x NY array "blocks" of PieceType's to save state of settled
-	// blocks, where NX = XMAX - XMIN, etc.  Set to NTYPES to indicate an empty
-	// grid block, or another enum value to indicate an occupied grid block.
-
-	log("Starting Piece::decompose()");
-	for (int i = 0; i < BLOCKS[t].size() / 2; i++)
+	for (int i = 0; i < b.size(); i += 2)
 	{
-		float xl, yl;
-		getBlock(i, xl, yl);
-		//log(fmt::format("xl yl = {} {}", xl, yl));
-
-		int ix = (int) floor(xl - XMIN);
-		int iy = (int) floor(yl - YMIN);
-		log(fmt::format("ix iy = {} {}", ix, iy));
-
-		blocks[ix][iy] = t;
-
-		// TODO: with textures, the rotation state could also be saved to
-		// a separate vec
+		glTranslatef( b[i],  b[i+1], 0.f); // push
+		drawBlock();
+		glTranslatef(-b[i], -b[i+1], 0.f); // pop
 	}
 }
 
 //========================================================================
 
-void Piece::getBlock(int i, float& bx, float& by)
-{
-	// Get the center xy coordinates of block index i in this piece
-
-	glPushMatrix();
-
-	// Start from identity, not whatever's in the stack.  We only care about the
-	// xy transformations here, not the projection view or other matrices.  This
-	// differs from drawPieces
-	glLoadIdentity();
-
-	// Apply translation and rotation
-	glTranslatef(x + sx, y, 0.0f);
-	glRotatef(r * ROTDEG, 0.0f, 0.0f, 1.0f);
-
-	// Get the transformation matrix
-	GLfloat mat[16];
-	glGetFloatv(GL_MODELVIEW_MATRIX, mat);
-
-	// Add 0.5 to account for block corner to center
-	vec4 vec = {BLOCKS[t][2*i] + 0.5f, BLOCKS[t][2*i+1] + 0.5f, 0, 1};
-
-	// Apply transformation matrix to vec to calculate out
-	vec4 out;
-	mat4x4gl_mul_vec4(out, mat, vec);
-
-	bx = out[0];
-	by = out[1];
-	//log(fmt::format("bx by = {} {}", bx, by));
-
-	glPopMatrix();
-}
-
-//========================================================================
-
-void Piece::getMin(float& xmin, float& ymin)
+void drawPieceList(const std::vector<Piece>& ps)
 {
-	// Get the min bounding xy coordinates of this piece
-	//
-	// TODO: leverage getCenters() and getCentersMin()
-
-	//log("Starting Piece::getMin()");
-
-	xmin = std::numeric_limits<float>::max();
-	ymin = std::numeric_limits<float>::max();
-
-	for (int i = 0; i < BLOCKS[t].size() / 2; i++)
+	if (enable_instancing && renderer.ok())
 	{
-		float xl, yl;
-		getBlock(i, xl, yl);
-		xmin = std::min(xmin, xl);
-		ymin = std::min(ymin, yl);
-
-		//log(fmt::format("xl yl = {} {}", xl, yl));
+		// Same shader and texture array as the settled blocks.  Blocks are
+		// placed by their centers, so the texture doesn't turn with the piece
+		std::vector<BlockInstance> bs;
+		for (auto p: ps)
+		{
+			auto c = p.getCenters();
+			for (int i = 0; i < NBLOCKS; i++)
+				bs.push_back({c[2*i] - 0.5f, c[2*i+1] - 0.5f, (float) p.t});
+		}
+		renderer.drawBlocks(bs, enable_texture);
+		return;
 	}
 
-	// Center to min corner
-	xmin -= 0.5f;
-	ymin -= 0.5f;
-
-	//log(fmt::format("xmin ymin = {} {}", xmin, ymin));
-}
-
-//========================================================================
-
-void getCentersMin(std::vector<float>& xy, float& xmin, float& ymin)
-{
-	// Get the min bounds of center coordinates xy
-
-	//log("Starting Piece::getCentersMin()");
-
-	xmin = std::numeric_limits<float>::max();
-	ymin = std::numeric_limits<float>::max();
-
-	for (int i = 0; i < xy.size(); i += 2)
+	// Immediate mode fallback, colors only
+	for (auto p: ps)
 	{
-		xmin = std::min(xmin, xy[i+0]);
-		ymin = std::min(ymin, xy[i+1]);
-
-		//log(fmt::format("xl yl = {} {}", xl, yl));
-	}
-
-	// Center to min corner
-	xmin -= 0.5f;
-	ymin -= 0.5f;
-
-	//log(fmt::format("xmin ymin = {} {}", xmin, ymin));
-}
-
-//========================================================================
+		glPushMatrix();
 
-void getCentersMax(std::vector<float>& xy, float& xmax, float& ymax)
-{
-	// Get the max bounds of center coordinates xy
+		float cx, cy;
+		p.getCenter(cx, cy);
+		glTranslatef(cx, cy, 0.0f);
 
-	//log("Starting Piece::getCentersMax()");
+		// Alternatively, could use mat4x4_rotate_Z()
+		glRotatef(p.r * ROTDEG, 0.0f, 0.0f, 1.0f);
 
-	xmax = std::numeric_limits<float>::min();
-	ymax = std::numeric_limits<float>::min();
+		// .data() returns a pointer to a C array
+		glMaterialfv(GL_FRONT, GL_DIFFUSE, COLORS[p.t].data());
 
-	for (int i = 0; i < xy.size(); i += 2)
-	{
-		xmax = std::max(xmax, xy[i+0]);
-		ymax = std::max(ymax, xy[i+1]);
+		drawPiece(BLOCKS[p.t]);
 
-		//log(fmt::format("xl yl = {} {}", xl, yl));
+		glPopMatrix();
 	}
-
-	// Center to max corner
-	xmax += 0.5f;
-	ymax += 0.5f;
-
-	//log(fmt::format("xmax ymax = {} {}", xmax, ymax));
 }
 
 //========================================================================
 
-std::vector<float> Piece::getCenters()
+void drawPieces(const Game& game, float alpha)
 {
-	// Get the xy coordinates of the center of each block in this piece
+	// Draw the active piece, a ghost of it where it would land, and a preview
+	// of the next pieces to the right of the board, soonest on top
 
-	//log("Starting Piece::getCenters()");
-
-	std::vector<float> xy;
-
-	for (int i = 0; i < BLOCKS[t].size() / 2; i++)
+	// The active piece is drawn between the last two ticks
+	std::vector<Piece> ps = {game.lerpPiece(alpha)};
+	for (int i = 0; i < NPREVIEW; i++)
 	{
-		float xl, yl;
-		getBlock(i, xl, yl);
-		xy.push_back(xl);
-		xy.push_back(yl);
-
-		//log(fmt::format("xl yl = {} {}", xl, yl));
+		Piece p;
+		p.t = game.preview[i];
+		p.x = NX + 3;
+		p.y = NY - 3 - 5 * i;
+		ps.push_back(p);
 	}
-
-	//log(fmt::format("xmin ymin = {} {}", xmin, ymin));
-	return xy;
-}
-
-//========================================================================
-
-void Piece::snapx()
-{
-	// Align to grid in x direction.  Pieces with odd dimensions have a center
-	// that is not grid aligned, so this needs to be applied when rotating
-
-	//log("Starting snapx()");
-
-	sx = 0.f;
-
-	float xl, yl;
-	getMin(xl, yl);
-	//if (abs((fmod(abs(xl), 1)) - 0.5) > 0.1)  // 0.1 tol may not be sufficient for snapy
-	//if (abs(fmod(xl, 1)) < 0.1)  // 0.1 tol may not be sufficient for snapy
-	if ((int) round((abs(xl) * 2)) % 2 == 1)
-		sx = 0.5f;
-
-	//log(fmt::format("snapx: sx = {}", sx));
+	drawPieceList(ps);
+
+	// The ghost is only drawn in outline, so that it can't be mistaken for
+	// settled blocks.  It comes from the column heights, so finding it is
+	// only a pass over the piece's width
+	if (game.over) return;
+	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	drawPieceList({game.ghost()});
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
 //========================================================================
 
-void Piece::move(float dx, float dy, bool key_initiated = true)
+void drawBlocks(const Game& game)
 {
-	// Backup position, try moving, check for collisions, and return to original
-	// position if needed.  If the piece is bottomed-out, destroy it and make
-	// a new piece at the top
-
-	//log("Starting Piece::move()");
-
-	auto x0 = x, y0 = y;
-
-	//y -= speed * (float) dt;
-	x += dx;
-	y += dy;
-
-	auto xy = getCenters();
-
-	// Clamp based on y bound, not center
-	float xl, yl;
-	getCentersMin(xy, xl, yl);
-	//log(fmt::format("y, yl, YMIN = {}, {}, {}", y, yl, YMIN));
-
-	// A tolerance of 0.05 is small enough to not notice the piece bounce back
-	// up after falling into a colision.  0.01 seems to work, but is probably to
-	// difficult to slip a piece under a ledge.  0.1 results in a noticeable
-	// bounce
-	double tol = 0.05;//0.2;
-
-	// TODO: work on key repeat logic to make ledge slipping easier.  Don't rely
-	// on OS repeat, just store our own hold/release state
-
-	if (xl < XMIN - tol)
-	{
-		// TODO: previous rotation too, here and elsewhere
-		x = x0;
-		//x += XMIN - xl;
-	}
-
-	if (yl < YMIN - tol)
+	if (enable_instancing && renderer.ok())
 	{
-		//y = y0;
-		y += YMIN - yl;
-
-		// Only make a new piece for collision in y dir.  Only downward motion
-		// (either natural falling or down key) can settle a piece, not
-		// rotations or x motion
-		piece.decompose();
-		newPiece();
+		// Uploads only happen when a piece settles or lines clear, and only
+		// for the rows that changed
+		renderer.update(game.blocks);
+		renderer.draw(enable_texture);
 		return;
 	}
 
-	getCentersMax(xy, xl, yl);
-	if (xl > XMAX + tol)
-	{
-		//x += XMAX - xl;
-		x = x0;
-	}
-
-	// There is no need to check ymax
-
-	// Check for collisions with settled blocks
-	bool collide = false;
-	for (int ix = 0; ix < blocks.size(); ix++)
-		for (int iy = 0; iy < blocks[ix].size(); iy++)
-		{
-			PieceType t = blocks[ix][iy];
-
-			// Skip empty blocks
-			if (t >= NTYPES) continue;
-
-			//// old block coordinates
-			//float x = ix + XMIN;
-			//float y = iy + YMIN;
-
-			//float ixb = (int) round(ix + XMIN);
-			//float iyb = (int) round(iy + YMIN);
-			//float xb = ix + XMIN + 0.5f;
-			//float yb = iy + YMIN + 0.5f;
-
-			// TODO: move invariant x outside of y loop
-			double xblo = ix + XMIN + 0 + tol;
-			double yblo = iy + YMIN + 0 + 0.8;//tol; // large tol here facilitates ledge slipping
-			double xbhi = ix + XMIN + 1 - tol;
-			double ybhi = iy + YMIN + 1 - tol;
-
-			for (int i = 0; i < xy.size(); i += 2)
-			{
-				// This piece's block center coordinates
-				xl = xy[i+0];
-				yl = xy[i+1];
-
-				// Range.  TODO: double or int?  tol?
-
-				//int ixlo = (int) floor(xl - 0.5f);
-				//int ixhi = (int) floor/*ceil*/ (xl + 0.5f);
-				//int iylo = (int) floor(yl - 0.5f);
-				//int iyhi = (int) floor/*ceil*/ (yl + 0.5f);
-
-				//int ixlo = (int) floor(xl - 0.5f + tol);
-				//int ixhi = (int) floor(xl + 0.5f - tol);
-				//int iylo = (int) floor(yl - 0.5f + tol);
-				//int iyhi = (int) floor(yl + 0.5f - tol);
-				//collide = ixlo <= ixb && ixb <= ixhi
-				//       && iylo <= iyb && iyb <= iyhi;
-				//collide = xlo <= xb && xb <= xhi
-				//       && ylo <= yb && yb <= yhi;
-
-				double xlo = xl - 0.5;// + tol;
-				double xhi = xl + 0.5;// - tol;
-				double ylo = yl - 0.5;// + tol;
-				double yhi = yl + 0.5;// - tol;
-
-				collide = !((xhi < xblo || xlo > xbhi) 
-				         || (yhi < yblo || ylo > ybhi));
-
-				if (collide) goto endloop;
-			}
-		}
-	endloop:
-
-	if (collide)
-	{
-		x = x0;
-		y = y0;
-
-		// TODO: check collide again now after reseting y.  don't decompose if
-		// it's clear.  Better yet, only allow decomposition for -dt based
-		// moves, not arrow-key initiated moves
-
-		// TODO: reset rotation, and maybe decompose and newPiece
-
-		// Allowing a badly-timed key-initiated decomposition results in a piece
-		// ending up 1 block higher than it should be
-		if (dy < 0 && !key_initiated)
-		{
-			piece.decompose();
-			newPiece();
-			return;
-		}
-	}
-
-}
-
-//========================================================================
-
-void drawPiece(std::vector<float> b)
-{
-	for (int i = 0; i < b.size(); i += 2)
-	{
-		glTranslatef( b[i],  b[i+1], 0.f); // push
-		drawBlock();
-		glTranslatef(-b[i], -b[i+1], 0.f); // pop
-	}
-}
-
-//========================================================================
-
-void drawPieces()
-{
-	// TODO: eliminate func? there's only 1 piece.  although, we may want to
-	// display a preview of the next piece before it becomes active
-
-	//for (auto p: pieces)
-	Piece p = piece;
-	{
-		glPushMatrix();
-
-		glTranslatef(p.x + p.sx, p.y, 0.0f);
-
-		// Alternatively, could use mat4x4_rotate_Z()
-		glRotatef(p.r * ROTDEG, 0.0f, 0.0f, 1.0f);
-
-		if (enable_texture)
-		{
-			glEnable(GL_TEXTURE_2D);
-			const GLfloat base_color[4]  = {1.0f, 1.0f, 1.0f, 1.0f};
-			glMaterialfv(GL_FRONT, GL_DIFFUSE, base_color);
-			glBindTexture(GL_TEXTURE_2D, tex_ids[p.t]);
-		}
-		else
-		{
-			// .data() returns a pointer to a C array
-			glMaterialfv(GL_FRONT, GL_DIFFUSE, COLORS[p.t].data());
-		}
-
-		drawPiece(BLOCKS[p.t]);
-
-		glDisable(GL_TEXTURE_2D);
-		glPopMatrix();
-	}
-}
-
-//========================================================================
-
-void drawBlocks()
-{
 	//log("Starting drawBlocks()");
 	//log(fmt::format("size blocks outer = {}", blocks   .size()));
 	//log(fmt::format("size blocks inner = {}", blocks[0].size()));
 
-	for (int ix = 0; ix < blocks.size(); ix++)
-		for (int iy = 0; iy < blocks[ix].size(); iy++)
+	for (int ix = 0; ix < NX; ix++)
+		for (int iy = 0; iy < NY; iy++)
 		{
-			PieceType t = blocks[ix][iy];
+			PieceType t = game.blocks.get(ix, iy);
 
 			// Skip empty blocks
 			if (t >= NTYPES) continue;
@@ -797,22 +382,11 @@ void drawBlocks()
 
 			glTranslatef(x, y, 0.0f);
 
-			if (enable_texture)
-			{
-				glEnable(GL_TEXTURE_2D);
-				const GLfloat base_color[4]  = {1.0f, 1.0f, 1.0f, 1.0f};
-				glMaterialfv(GL_FRONT, GL_DIFFUSE, base_color);
-				glBindTexture(GL_TEXTURE_2D, tex_ids[t]);
-			}
-			else
-			{
-				// .data() returns a pointer to a C array
-				glMaterialfv(GL_FRONT, GL_DIFFUSE, COLORS[t].data());
-			}
+			// .data() returns a pointer to a C array
+			glMaterialfv(GL_FRONT, GL_DIFFUSE, COLORS[t].data());
 
 			drawBlock();
 
-			glDisable(GL_TEXTURE_2D);
 			glPopMatrix();
 
 		}
@@ -820,6 +394,25 @@ void drawBlocks()
 
 //========================================================================
 
+std::vector<GLfloat> boardLines()
+{
+	// World boundary and vertical grid lines, as xyz pairs for GL_LINES
+
+	std::vector<GLfloat> v =
+	{
+		XMIN, YMIN, 0,  XMAX, YMIN, 0,
+		XMIN, YMAX, 0,  XMAX, YMAX, 0,
+	};
+
+	const float GRID_SPACING = 4;
+	for (float x = XMIN; x <= XMAX + 0.1f; x += GRID_SPACING)
+		v.insert(v.end(), {x, YMIN, 0,  x, YMAX, 0});
+
+	return v;
+}
+
+//========================================================================
+
 void drawBoard()
 {
 	// Draw world boundary and vertical grid lines, because perspective makes it
@@ -829,30 +422,26 @@ void drawBoard()
 	// pieces
 	glDisable(GL_LIGHTING);
 
-	glBegin(GL_LINES);
-
 	glColor3f(0.8f, 0.8f, 0.8f);
 
-	glVertex3f(XMIN, YMIN, 0);
-	glVertex3f(XMAX, YMIN, 0);
-
-	glVertex3f(XMIN, YMAX, 0);
-	glVertex3f(XMAX, YMAX, 0);
-
-	const float GRID_SPACING = 4;
-	for (float x = XMIN; x <= XMAX + 0.1f; x += GRID_SPACING)
+	if (enable_instancing && renderer.ok())
+		renderer.drawLines();
+	else
 	{
-		glVertex3f(x, YMIN, 0);
-		glVertex3f(x, YMAX, 0);
+		static const std::vector<GLfloat> v = boardLines();
+
+		glBegin(GL_LINES);
+		for (size_t i = 0; i < v.size(); i += 3)
+			glVertex3f(v[i], v[i+1], v[i+2]);
+		glEnd();
 	}
 
-	glEnd();
 	glEnable(GL_LIGHTING);
 }
 
 //========================================================================
 
-void drawScene()
+void drawScene(const Game& game, float alpha)
 {
 	const GLfloat model_diffuse[4]  = {1.0f, 0.8f, 0.8f, 1.0f};
 	const GLfloat model_specular[4] = {0.6f, 0.6f, 0.6f, 1.0f};
@@ -873,16 +462,25 @@ void drawScene()
 	glMaterialfv(GL_FRONT, GL_SPECULAR, model_specular);
 	glMaterialf(GL_FRONT, GL_SHININESS, model_shininess);
 
-	drawBoard();
-	drawPieces();
-	drawBlocks();
+	{
+		PROF_GPU_SCOPE(PROF_BOARD);
+		drawBoard();
+	}
+	{
+		PROF_GPU_SCOPE(PROF_PIECES);
+		drawPieces(game, alpha);
+	}
+	{
+		PROF_GPU_SCOPE(PROF_BLOCKS);
+		drawBlocks(game);
+	}
 
 	glPopMatrix();
 }
 
 //========================================================================
 
-void drawAllViews()
+void drawAllViews(const Game& game, float alpha)
 {
 	// Set light position based on world size
 	const GLfloat light_position[4] = {1.5 * WXH, -0.5 * WY, WY, 1.0f};
@@ -905,22 +503,26 @@ void drawAllViews()
 	glClear(GL_DEPTH_BUFFER_BIT);
 
 	// Gradient background (c.f. JeffIrwin/rubik-js)
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
+	{
+		PROF_GPU_SCOPE(PROF_BACKGROUND);
 
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-
-	glBegin(GL_QUADS);
-	glColor3f(0.082f, 0.341f, 0.6f);
-	glVertex2f(-1.0, 1.0);
-	glColor3f(0.082f, 0.471f, 0.471f);
-	glVertex2f(-1.0,-1.0);
-	glColor3f(0.082f, 0.6f, 0.341f);
-	glVertex2f(1.0,-1.0);
-	glColor3f(0.082f, 0.471f, 0.471f);
-	glVertex2f(1.0, 1.0);
-	glEnd();
+		glMatrixMode(GL_PROJECTION);
+		glLoadIdentity();
+
+		glMatrixMode(GL_MODELVIEW);
+		glLoadIdentity();
+
+		glBegin(GL_QUADS);
+		glColor3f(0.082f, 0.341f, 0.6f);
+		glVertex2f(-1.0, 1.0);
+		glColor3f(0.082f, 0.471f, 0.471f);
+		glVertex2f(-1.0,-1.0);
+		glColor3f(0.082f, 0.6f, 0.341f);
+		glVertex2f(1.0,-1.0);
+		glColor3f(0.082f, 0.471f, 0.471f);
+		glVertex2f(1.0, 1.0);
+		glEnd();
+	}
 
 	// Enable depth test
 	glEnable(GL_DEPTH_TEST);
@@ -937,7 +539,7 @@ void drawAllViews()
 	// Setup perspective projection matrix
 	glMatrixMode(GL_PROJECTION);
 	mat4x4_perspective(projection,
-					   65.f * (float) M_PI / 180.f,
+					   FOVY,
 					   aspect,
 					   1.f, 50.f); // last arg (50) controls zFar culling
 	glLoadMatrixf((const GLfloat*) projection);
@@ -955,7 +557,7 @@ void drawAllViews()
 		//vec3 center = {0.f, -0.5 * WY, 0.f};
 
 		// easier to judge alignment (at least until I implement gridlines)
-		vec3 eye = {0, -0.5 * WY, 0.95 * WY};
+		vec3 eye = {0, -0.5 * WY, EYE_Z};
 		vec3 center = {0, -0.5 * WY, 0};
 
 		//vec3 eye = { 3.f, 1.5f, 4.f };
@@ -974,7 +576,7 @@ void drawAllViews()
 	glEnable(GL_LIGHTING);
 
 	// Draw scene
-	drawScene();
+	drawScene(game, alpha);
 
 	// Disable lighting
 	glDisable(GL_LIGHTING);
@@ -994,15 +596,106 @@ void framebufferSizeFun(GLFWwindow* window, int w, int h)
 
 	width  = w;
 	height = h > 0 ? h : 1;
+	redraw.request();
 }
 
 //========================================================================
 
 void windowRefreshFun(GLFWwindow* window)
 {
-	// Window refresh callback function
-	drawAllViews();
-	glfwSwapBuffers(window);
+	// The window was uncovered or needs to be redrawn for some other reason.
+	// The render thread does the drawing
+	redraw.request();
+}
+
+//========================================================================
+
+void windowFocusFun(GLFWwindow* window, int f)
+{
+	focused = f == GLFW_TRUE;
+	redraw.request();
+}
+
+//========================================================================
+
+void windowIconifyFun(GLFWwindow* window, int i)
+{
+	// Nobody can see a minimized game, so stop it altogether
+	iconified = i == GLFW_TRUE;
+	sim.pause(PAUSE_HIDDEN, iconified);
+	redraw.request();
+}
+
+//========================================================================
+
+float texturePixels()
+{
+	// Screen pixels that one repeat of a block texture covers, i.e. 1 / TC
+	// blocks.  The board is all at about the same distance from the eye, so
+	// this is the same for every block
+	float block = height / (2 * EYE_Z * tanf(0.5f * FOVY));
+	return block / TC;
+}
+
+//========================================================================
+
+void drawFrame(GLFWwindow* window, const Snapshot& snap)
+{
+	// Draw the newest game state and swap.  Render thread only
+
+	profFrame();
+	PROF_SCOPE(PROF_FRAME);
+
+	double t_start = glfwGetTime();
+	drawAllViews(snap.game, snap.alpha(steadyTime()));
+	profDrawHud(width, height);
+	double t_drawn = glfwGetTime();
+	{
+		PROF_SCOPE(PROF_SWAP);
+		glfwSwapBuffers(window);
+	}
+
+	// Draw time is CPU time spent submitting the scene.  Frame time is the
+	// time between swaps, which includes waiting on the GPU (and on vsync if
+	// it's on)
+	FrameStats& fs = frame_stats;
+	if (fs.n == 0 && fs.t0 == 0) fs.t0 = t_start;
+	fs.draw += t_drawn - t_start;
+	fs.n++;
+
+	// The swap returning is as close to photons as we can see from here.
+	// The display may still add a refresh or so on top
+	if (snap.input_t > fs.input_t)
+	{
+		double lat = steadyTime() - snap.input_t;
+		fs.latency += lat;
+		fs.latency_max = std::max(fs.latency_max, lat);
+		fs.nlatency++;
+		fs.input_t = snap.input_t;
+	}
+
+	double t_end = glfwGetTime();
+	if (t_end - fs.t0 >= 5.0)
+	{
+		int nblocks = 0;
+		for (auto c: snap.game.blocks.counts)
+			nblocks += c;
+
+		log(fmt::format("render {:.1f} fps, frame {:.3f} ms, draw {:.3f} ms, {} blocks, {}, vsync {}, {} rows uploaded",
+				fs.n / (t_end - fs.t0), 1e3 * (t_end - fs.t0) / fs.n,
+				1e3 * fs.draw / fs.n, nblocks,
+				enable_instancing && renderer.ok() ? "instanced" : "immediate",
+				vsync ? "on" : "off", renderer.nrows));
+		if (fs.nlatency > 0)
+			log(fmt::format("input to swap {:.1f} ms, max {:.1f} ms, {} key events",
+					1e3 * fs.latency / fs.nlatency, 1e3 * fs.latency_max,
+					fs.nlatency));
+		fs.t0 = t_end;
+		fs.draw = 0;
+		fs.n = 0;
+		fs.latency = fs.latency_max = 0;
+		fs.nlatency = 0;
+	}
 }
 
 //========================================================================
@@ -1082,35 +775,171 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	//if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 	//	glfwSetWindowShouldClose(window, GLFW_TRUE);
 
-	if (action == GLFW_PRESS || action == GLFW_REPEAT)
+	// Game keys go to the game thread as presses and releases, stamped with
+	// the time they arrive.  It does its own key repeat, so OS repeats are
+	// ignored
+	Key k = NKEYS;
+	switch (key)
+	{
+		case GLFW_KEY_LEFT : k = KEY_LEFT ; break;
+		case GLFW_KEY_RIGHT: k = KEY_RIGHT; break;
+		case GLFW_KEY_DOWN : k = KEY_DOWN ; break;
+		case GLFW_KEY_J    : k = KEY_CCW  ; break;
+		case GLFW_KEY_K    : k = KEY_CW   ; break;
+		case GLFW_KEY_SPACE: k = KEY_DROP ; break;
+		case GLFW_KEY_A    : k = KEY_AI   ; break;
+		case GLFW_KEY_R    : k = KEY_REPLAY; break;
+		default: break;
+	}
+	if (k != NKEYS && action != GLFW_REPEAT)
+	{
+		sim.input(k, action == GLFW_PRESS);
+		return;
+	}
+
+	if (action == GLFW_PRESS)
+	{
+		if (key == GLFW_KEY_P)
+		{
+			player_paused = !player_paused;
+			sim.pause(PAUSE_PLAYER, player_paused);
+			log(player_paused ? "paused" : "unpaused");
+		}
+		else if (key == GLFW_KEY_I)
+		{
+			enable_instancing = !enable_instancing;
+			log(fmt::format("instanced blocks {}", enable_instancing ? "on" : "off"));
+		}
+		else if (key == GLFW_KEY_V)
+		{
+			// The render thread applies it, since it owns the context
+			vsync = !vsync;
+			log(fmt::format("vsync {}", vsync ? "on" : "off"));
+		}
+		else if (key == GLFW_KEY_H)
+			profToggleHud();
+		else if (key == GLFW_KEY_T)
+			profToggleTrace();
+		redraw.request();
+	}
+}
+
+//========================================================================
+
+void renderLoop(GLFWwindow* window, TextureStreamer& textures)
+{
+	// Draw frames, each from the newest snapshot of the game, until the main
+	// thread sets quit.  How often depends on the mode:
+	//
+	//     active:      every frame, as fast as vsync allows, since the active
+	//                  piece is interpolated and moves every frame
+	//     background:  the window doesn't have focus.  Only draw new
+	//                  snapshots or requested redraws, and at most
+	//                  BACKGROUND_FPS
+	//     idle:        the game is paused or the window is minimized.  Only
+	//                  draw requested redraws (never while minimized)
+	//
+	// In between, sleep until woken or until the next tick is due, which
+	// keeps an idle game off the CPU and the GPU
+
+	glfwMakeContextCurrent(window);
+	profThread("render");
+
+	bool swap_vsync = vsync;
+	glfwSwapInterval(swap_vsync ? 1 : 0);
+
+	// Wall time and CPU time of the whole process spent in each mode, logged
+	// every few seconds
+	std::array<double, NMODES> mode_wall = {}, mode_cpu = {};
+	double t_sample = steadyTime(), cpu_sample = cpuTime(), t_log = t_sample;
+	RenderMode mode = ACTIVE;
+
+	int64_t drawn_seq = -1;
+	double t_drawn = 0;
+	bool first_frame = true;
+	while (!quit)
 	{
-		if (key == GLFW_KEY_LEFT)
-			piece.move(-1,  0);
-		else if (key == GLFW_KEY_RIGHT)
-			piece.move( 1,  0);
-		else if (key == GLFW_KEY_DOWN)
-			piece.move( 0, -1);
-		else if (key == GLFW_KEY_J)
+		double now = steadyTime(), cpu_now = cpuTime();
+		mode_wall[mode] += now - t_sample;
+		mode_cpu [mode] += cpu_now - cpu_sample;
+		t_sample = now;
+		cpu_sample = cpu_now;
+
+		if (now - t_log >= 5.0)
+		{
+			std::string str;
+			for (int i = 0; i < NMODES; i++)
+				if (mode_wall[i] > 0)
+					str += fmt::format("{}{} {:.1f}% over {:.1f} s",
+							str.empty() ? "" : ", ", MODE_NAMES[i],
+							100 * mode_cpu[i] / mode_wall[i], mode_wall[i]);
+			log("cpu " + str);
+
+			mode_wall.fill(0);
+			mode_cpu.fill(0);
+			t_log = now;
+		}
+
+		if (vsync != swap_vsync)
+		{
+			swap_vsync = vsync;
+			glfwSwapInterval(swap_vsync ? 1 : 0);
+		}
+
+		// Take the request before the snapshot, so that a snapshot published
+		// in between leaves a new request behind instead of being missed
+		bool requested = redraw.take();
+		const Snapshot& snap = sim.latest();
+
+		mode = iconified || snap.paused ? IDLE : focused ? ACTIVE : BACKGROUND;
+
+		bool retextured = false;
+		if (enable_texture)
+		{
+			PROF_SCOPE(PROF_TEXTURES);
+			retextured = textures.update(texturePixels());
+		}
+		if (retextured)
+		{
+			renderer.setTextures(textures.texture());
+			requested = true;
+		}
+
+		if (mode == BACKGROUND && now < t_drawn + 1 / BACKGROUND_FPS)
 		{
-			// Rotate CCW
-			//
-			// TODO: make this a function that detects collisions.  Combine with
-			// move() (extra arg for rot)?
-			//
-			// Add an extra NROT to prevent underflow.  Anyway for a 1-byte int
-			// mod 4, it doesn't matter because 255%4 == 3%4
-			piece.r = (piece.r + NROT + 1u) % NROT;
-			piece.snapx();
-			log(fmt::format("r = {}", piece.r));
+			// Too soon.  Keep the request for when it's time
+			if (requested) redraw.request();
+			std::this_thread::sleep_for(std::chrono::duration<double>(
+					t_drawn + 1 / BACKGROUND_FPS - now));
+			continue;
 		}
-		else if (key == GLFW_KEY_K)
+
+		bool draw = mode == ACTIVE || requested || snap.seq != drawn_seq;
+		if (iconified || !draw)
+		{
+			// Nothing new.  A snapshot comes with a request, so the timeout
+			// is only a backstop:  the next tick while ticking, or the next
+			// stats log while idle
+			double timeout = mode == IDLE ? t_log + 5.0 - now
+					: snap.t + TICK - now;
+			redraw.wait(std::max(timeout, 0.001));
+			continue;
+		}
+
+		drawFrame(window, snap);
+		drawn_seq = snap.seq;
+		t_drawn = now;
+
+		// GLFW's timer starts at glfwInit(), which is close enough to the
+		// start of main()
+		if (first_frame)
 		{
-			// Rotate CW
-			piece.r = (piece.r + NROT - 1u) % NROT;
-			piece.snapx();
-			log(fmt::format("r = {}", piece.r));
+			log(fmt::format("Time to first frame:  {:.3f} s", glfwGetTime()));
+			first_frame = false;
 		}
 	}
+
+	glfwMakeContextCurrent(NULL);
 }
 
 //========================================================================
@@ -1178,95 +1007,81 @@ int main()
 	// Set callback functions
 	glfwSetFramebufferSizeCallback(window, framebufferSizeFun);
 	glfwSetWindowRefreshCallback(window, windowRefreshFun);
+	glfwSetWindowFocusCallback(window, windowFocusFun);
+	glfwSetWindowIconifyCallback(window, windowIconifyFun);
 	glfwSetCursorPosCallback(window, cursorPosFun);
 	glfwSetMouseButtonCallback(window, mouseButtonFun);
 	glfwSetKeyCallback(window, key_callback);
 
-	// Enable vsync
+	// Set up GL on this thread, until the render thread takes the context
 	glfwMakeContextCurrent(window);
 	gladLoadGL(glfwGetProcAddress);
-	glfwSwapInterval(1);
 
 	if (GLAD_GL_ARB_multisample || GLAD_GL_VERSION_1_3)
 		glEnable(GL_MULTISAMPLE_ARB);
 
-	glfwGetFramebufferSize(window, &width, &height);
-	framebufferSizeFun(window, width, height);
+	int fb_width, fb_height;
+	glfwGetFramebufferSize(window, &fb_width, &fb_height);
+	framebufferSizeFun(window, fb_width, fb_height);
+
+	if (renderer.init(COLORS))
+		renderer.setLines(boardLines());
 
 	//****************
 
-	if (enable_texture)
+	if (enable_texture && !renderer.ok())
 	{
-		// Load textures from resource files
+		logerr("Error: textures need the instanced renderer, using colors");
+		enable_texture = false;
+	}
 
-		tex_ids.reserve(TEX_FILES.size());
-		int i = 0;
-		for (auto f: TEX_FILES)
-		{
-			GLFWimage tex = png2gimg(f);
+	// One pool for the autoplayer's lookahead and another for texture
+	// loading.  A pool runs one parallelFor() at a time, so with only one,
+	// ticks on the game thread would wait behind decoding whole PNGs
+	ThreadPool pool, tex_pool;
 
-			// Upload texture(s)
+	// Load textures from resource files into the layers of one array texture,
+	// layer t for piece type t.  This only starts the loading, and blocks
+	// are drawn with colors until the first (coarse) textures are in
+	TextureStreamer textures;
+	if (enable_texture)
+		textures.start(std::vector<std::string>(TEX_FILES.begin(),
+				TEX_FILES.begin() + NTYPES), TEX_CACHE, tex_pool, TEX_BUDGET);
 
-			glGenTextures(1, &tex_ids[i]);
-			glBindTexture(GL_TEXTURE_2D, tex_ids[i]);
-			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	//****************
 
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.width, tex.height,
-					0, GL_RGBA, GL_UNSIGNED_BYTE, tex.pixels);
+	log(fmt::format("NX NY = {} {}", NX, NY));
 
-			// Mipmaps optimize hi-res images for display on small objects.
+	// Let the autoplayer's pieces fall under gravity so they can be watched
+	sim.ai.drop = false;
 
-			// TODO: outside loop?
-			//glGenerateMipmap(GL_TEXTURE_2D);
+	// Plan for the active piece and the first 2 previewed pieces, spread over
+	// all cores
+	sim.ai.pool = &pool;
+	sim.ai.depth = 3;
 
-			i++;
-		}
-		glGenerateMipmap(GL_TEXTURE_2D);
-	}
-
-	//****************
+	// New snapshots wake the render thread when it's waiting for one
+	sim.on_publish = []{ redraw.request(); };
 
 	// Seed rng for piece generation
-	srand((unsigned int) time(NULL));
-	ip = -1;
-	newPiece();
+	sim.start((uint64_t) time(NULL));
 
-	log(fmt::format("NX NY = {} {}", NX, NY));
-
-	// Mark all blocks as empty initially.  Is vec<vec> the right data struct
-	// here?  It sure is a pain to initialize
-	for (int ix = 0; ix < blocks.size(); ix++) //(auto col: blocks)
-		for (int iy = 0; iy < blocks[ix].size(); iy++)//(auto block: col)
-			blocks[ix][iy] = NTYPES;
+	// Hand the context over to the render thread
+	glfwMakeContextCurrent(NULL);
+	std::thread render(renderLoop, window, std::ref(textures));
 
 	//log(fmt::format("enum = {} {} {} {} {} {}", I, L, O, S, G, Z));
 	log("Starting main loop");
 
-	// Main loop
-	t0 = glfwGetTime();
-	for (;;)
-	{
-		// Timing
-		t = glfwGetTime();
-		dt = t - t0;
-		t0 = t;
-
-		windowRefreshFun(window);
-
-		// Wait for new events
-		//glfwWaitEvents();
-		glfwPollEvents();
-
-		piece.move(0, -speed * (float) dt, false);
+	// Main loop.  This thread only handles events now, so it can just wait
+	// for them
+	while (!glfwWindowShouldClose(window))
+		glfwWaitEvents();
 
-		// Check if the window should be closed
-		if (glfwWindowShouldClose(window))
-			break;
-	}
+	quit = true;
+	redraw.request();
+	render.join();
+	sim.stop();
 
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
@@ -0,0 +1,268 @@
+
+//========================================================================
+//
+// Piece shapes and their rotation tables.  Nothing in here touches GL, and
+// everything is generated at compile time
+//
+//========================================================================
+
+#ifndef TETRIS_PIECE_H
+#define TETRIS_PIECE_H
+
+#include <array>
+#include <stdint.h>
+
+//========================================================================
+
+// Tetris pieces are shaped (roughly) like these letters.  G is like uppercase
+// gamma (reverse L).  One byte, so that grid rows are compact
+enum PieceType : uint8_t {I, L, O, S, G, Z, T, NTYPES};
+
+const uint8_t NROT = 4;
+const float ROTDEG = 360.f / NROT;
+
+// Number of blocks per piece
+const int NBLOCKS = 4;
+
+// Define each piece in terms of an array of xy translations of each block
+// relative to the piece's center.  Order of vector components must be the same
+// as in the PieceType enum.
+constexpr std::array<std::array<float, 2 * NBLOCKS>, NTYPES> BLOCKS =
+	{{
+		{ // I
+			-0.5, -2,
+			-0.5, -1,
+			-0.5,  0,
+			-0.5,  1
+		},
+		{ // L
+			-1,  0.5,
+			-1, -0.5,
+			-1, -1.5,
+			 0, -1.5
+		},
+		{ // O
+			 0,  0,
+			-1,  0,
+			-1, -1,
+			 0, -1
+		},
+		{ // S
+			-1.5, -1,
+			-0.5, -1,
+			-0.5,  0,
+			 0.5,  0
+		},
+		{ // G (L mirror)
+			 0,  0.5,
+			 0, -0.5,
+			 0, -1.5,
+			-1, -1.5
+		},
+		{ // Z (S mirror)
+			 0.5, -1,
+			-0.5, -1,
+			-0.5,  0,
+			-1.5,  0
+		},
+		{ // T
+			-1.5, -1,
+			-0.5, -1,
+			 0.5, -1,
+			-0.5,  0
+		}
+	}};
+
+//========================================================================
+
+// Everything the game logic needs to know about one piece type in one rotation
+// state
+struct Rotation
+{
+	// Block center offsets from the piece center, interleaved xy, in units of
+	// half blocks.  From the min corner of the piece's origin cell, the center
+	// of block i is at
+	//
+	//     sx + 0.5 * h[2*i], sy + 0.5 * h[2*i+1]
+	//
+	int8_t h[2 * NBLOCKS] = {};
+
+	// Integer cell offsets of each block from the piece's origin cell
+	int8_t dx[NBLOCKS] = {}, dy[NBLOCKS] = {};
+
+	// Inclusive bounding box of dx and dy
+	int8_t xmin = 0, xmax = 0, ymin = 0, ymax = 0;
+
+	// Occupancy mask of each row of the bounding box, from the bottom up.  Bit
+	// j of rowbits[k] is set if there's a block at (xmin + j, ymin + k).  These
+	// line up with the Grid bitboard rows after a shift
+	uint8_t rowbits[NBLOCKS] = {};
+
+	// Lowest block of each column of the bounding box, from the bottom up, for
+	// finding where the piece lands on the column heights.  Only the first
+	// xmax - xmin + 1 are used
+	int8_t colbottom[NBLOCKS] = {};
+
+	// Offset (0 or 0.5 each way) of the piece center from the min corner of
+	// its origin cell.  The blocks are always aligned to the grid, so these
+	// only matter for drawing the piece rotated about its center
+	float sx = 0, sy = 0;
+};
+
+constexpr int8_t floordiv2(int8_t a)
+{
+	return (a - (a < 0 ? 1 : 0)) / 2;
+}
+
+constexpr std::array<std::array<Rotation, NROT>, NTYPES> initRotations()
+{
+	// BLOCKS holds block corners, so add 0.5 to get the center and then double
+	// everything to get integer half-block units.  Rotating CCW by 90 degrees
+	// maps (x, y) to (-y, x), same as glRotatef with a positive angle
+
+	std::array<std::array<Rotation, NROT>, NTYPES> rots = {};
+	for (int t = 0; t < NTYPES; t++)
+	{
+		int8_t h[2 * NBLOCKS] = {};
+		for (int i = 0; i < 2 * NBLOCKS; i++)
+			h[i] = (int8_t) (2 * BLOCKS[t][i] + 1);
+
+		for (int r = 0; r < NROT; r++)
+		{
+			Rotation& rot = rots[t][r];
+
+			// All blocks of a piece have the same parity in half-block units.
+			// An even center offset means the center lies on a grid line
+			rot.sx = h[0] % 2 == 0 ? 0.5f : 0.f;
+			rot.sy = h[1] % 2 == 0 ? 0.5f : 0.f;
+
+			rot.xmin = rot.ymin = INT8_MAX;
+			rot.xmax = rot.ymax = INT8_MIN;
+			for (int i = 0; i < NBLOCKS; i++)
+			{
+				rot.h[2*i+0] = h[2*i+0];
+				rot.h[2*i+1] = h[2*i+1];
+
+				rot.dx[i] = floordiv2(h[2*i+0]);
+				rot.dy[i] = floordiv2(h[2*i+1]);
+
+				rot.xmin = rot.dx[i] < rot.xmin ? rot.dx[i] : rot.xmin;
+				rot.xmax = rot.dx[i] > rot.xmax ? rot.dx[i] : rot.xmax;
+				rot.ymin = rot.dy[i] < rot.ymin ? rot.dy[i] : rot.ymin;
+				rot.ymax = rot.dy[i] > rot.ymax ? rot.dy[i] : rot.ymax;
+			}
+			for (int i = 0; i < NBLOCKS; i++)
+				rot.colbottom[i] = INT8_MAX;
+			for (int i = 0; i < NBLOCKS; i++)
+			{
+				int j = rot.dx[i] - rot.xmin, k = rot.dy[i] - rot.ymin;
+				rot.rowbits[k] |= 1 << j;
+				rot.colbottom[j] = k < rot.colbottom[j] ? k : rot.colbottom[j];
+			}
+
+			// Rotate for the next state
+			for (int i = 0; i < NBLOCKS; i++)
+			{
+				int8_t hx = h[2*i+0];
+				h[2*i+0] = -h[2*i+1];
+				h[2*i+1] = hx;
+			}
+		}
+	}
+	return rots;
+}
+
+constexpr std::array<std::array<Rotation, NROT>, NTYPES> ROTATIONS =
+	initRotations();
+
+// Spot checks that the tables really are generated at compile time
+static_assert(ROTATIONS[I][0].xmin == 0 && ROTATIONS[I][0].xmax == 0 &&
+		ROTATIONS[I][0].ymin == -2 && ROTATIONS[I][0].ymax == 1,
+		"bad I bounding box");
+static_assert(ROTATIONS[I][0].sx == 0.5f && ROTATIONS[I][1].sx == 0.f &&
+		ROTATIONS[I][1].xmin == -2 && ROTATIONS[I][1].xmax == 1,
+		"bad rotated I");
+static_assert(ROTATIONS[T][0].rowbits[0] == 0x7 &&
+		ROTATIONS[T][0].rowbits[1] == 0x2, "bad T row masks");
+static_assert(ROTATIONS[T][2].colbottom[0] == 1 &&
+		ROTATIONS[T][2].colbottom[1] == 0, "bad T column bottoms");
+static_assert(ROTATIONS[O][1].sx == 0.f && ROTATIONS[O][1].sy == 0.f,
+		"bad O snap");
+
+//========================================================================
+
+// Wall kicks, SRS style.  A turn tries the piece in its new rotation state at
+// each of NKICKS offsets in order, and the first that fits wins.  The first
+// offset is always (0, 0), i.e. no kick
+const int NKICKS = 5;
+
+struct Kick
+{
+	int8_t dx = 0, dy = 0;
+};
+
+typedef std::array<Kick, NKICKS> Kicks;
+
+// The SRS tables for clockwise turns out of each SRS state:  0 (spawn), R,
+// 2 and L, i.e. 0->R, R->2, 2->L and L->0.  Cells, with y up.  The
+// counterclockwise kicks are the reverse turns negated
+constexpr std::array<Kicks, NROT> SRS_JLSTZ =
+	{{
+		{{{0, 0}, {-1, 0}, {-1,  1}, {0, -2}, {-1, -2}}},
+		{{{0, 0}, { 1, 0}, { 1, -1}, {0,  2}, { 1,  2}}},
+		{{{0, 0}, { 1, 0}, { 1,  1}, {0, -2}, { 1, -2}}},
+		{{{0, 0}, {-1, 0}, {-1, -1}, {0,  2}, {-1,  2}}}
+	}};
+
+constexpr std::array<Kicks, NROT> SRS_I =
+	{{
+		{{{0, 0}, {-2, 0}, { 1, 0}, {-2, -1}, { 1,  2}}},
+		{{{0, 0}, {-1, 0}, { 2, 0}, {-1,  2}, { 2, -1}}},
+		{{{0, 0}, { 2, 0}, {-1, 0}, { 2,  1}, {-1, -2}}},
+		{{{0, 0}, { 1, 0}, {-2, 0}, { 1, -2}, {-2,  1}}}
+	}};
+
+constexpr std::array<std::array<std::array<Kicks, 2>, NROT>, NTYPES>
+	initKicks()
+{
+	// KICKS[t][r][0] is for turning CCW out of rotation state r and [1] is
+	// for CW.  State r here is r CCW turns from BLOCKS, so taking that as SRS
+	// 0, CW goes 0 -> R, and r = 1 is SRS L.  O turns in place and never
+	// needs a kick, so it only gets (0, 0)
+
+	std::array<std::array<std::array<Kicks, 2>, NROT>, NTYPES> kicks = {};
+	for (int t = 0; t < NTYPES; t++)
+	{
+		if (t == O) continue;
+		const std::array<Kicks, NROT>& srs = t == I ? SRS_I : SRS_JLSTZ;
+
+		for (int r = 0; r < NROT; r++)
+		{
+			int s = (NROT - r) % NROT;
+			for (int k = 0; k < NKICKS; k++)
+			{
+				// CCW from s is the reverse of CW into s
+				const Kick& back = srs[(s + NROT - 1) % NROT][k];
+				kicks[t][r][0][k].dx = -back.dx;
+				kicks[t][r][0][k].dy = -back.dy;
+				kicks[t][r][1][k] = srs[s][k];
+			}
+		}
+	}
+	return kicks;
+}
+
+constexpr std::array<std::array<std::array<Kicks, 2>, NROT>, NTYPES> KICKS =
+	initKicks();
+
+// 0 -> L and L -> 0 in SRS
+static_assert(KICKS[T][0][0][1].dx == 1 && KICKS[T][0][0][1].dy == 0 &&
+		KICKS[T][1][1][2].dx == -1 && KICKS[T][1][1][2].dy == -1,
+		"bad T kicks");
+static_assert(KICKS[I][0][1][4].dx == 1 && KICKS[I][0][1][4].dy == 2,
+		"bad I kicks");
+
+//========================================================================
+
+#endif
+
@@ -0,0 +1,143 @@
+
+//========================================================================
+//
+// A small work-stealing thread pool
+//
+//========================================================================
+
+#include <pool.h>
+
+#include <algorithm>
+
+//========================================================================
+
+ThreadPool::ThreadPool(int nthreads)
+{
+	if (nthreads <= 0)
+		nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (int i = 0; i < nthreads; i++)
+		slices.push_back(std::make_unique<Slice>());
+
+	for (int i = 0; i < nthreads; i++)
+		workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+//========================================================================
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stop = true;
+	}
+	cv_start.notify_all();
+
+	for (auto& w: workers)
+		w.join();
+}
+
+//========================================================================
+
+void ThreadPool::parallelFor(int64_t n,
+		const std::function<void(int64_t, int)>& f)
+{
+	if (n <= 0) return;
+
+	// One job at a time, if more than one thread is using the pool
+	std::lock_guard<std::mutex> turn(caller);
+
+	// Workers are all idle between jobs, so the slices can be set without
+	// locking them
+	int nt = size();
+	for (int i = 0; i < nt; i++)
+	{
+		slices[i]->lo = n *  i      / nt;
+		slices[i]->hi = n * (i + 1) / nt;
+	}
+
+	std::unique_lock<std::mutex> lock(m);
+	job = &f;
+	active = nt;
+	generation++;
+	cv_start.notify_all();
+
+	cv_done.wait(lock, [this]{ return active == 0; });
+	job = nullptr;
+}
+
+//========================================================================
+
+bool ThreadPool::next(int id, int64_t& i)
+{
+	// Get the next index for worker id, stealing if its own slice is empty
+
+	Slice& own = *slices[id];
+	{
+		std::lock_guard<std::mutex> lock(own.m);
+		if (own.lo < own.hi)
+		{
+			i = own.lo++;
+			return true;
+		}
+	}
+
+	int nt = size();
+	for (int k = 1; k < nt; k++)
+	{
+		Slice& victim = *slices[(id + k) % nt];
+
+		int64_t lo, hi;
+		{
+			std::lock_guard<std::mutex> lock(victim.m);
+			int64_t left = victim.hi - victim.lo;
+			if (left <= 0) continue;
+
+			// Take the back half, rounding up so a single item can be stolen
+			hi = victim.hi;
+			lo = victim.hi - (left + 1) / 2;
+			victim.hi = lo;
+		}
+
+		std::lock_guard<std::mutex> lock(own.m);
+		i = lo;
+		own.lo = lo + 1;
+		own.hi = hi;
+		return true;
+	}
+
+	// Everything looked empty.  A slice scanned early on could have grown
+	// since, when its worker stole, so there may be work left, but it's owned
+	// by a worker that's still running and will get to it.  Leaving now only
+	// costs parallelism, never items
+	return false;
+}
+
+//========================================================================
+
+void ThreadPool::work(int id)
+{
+	int64_t seen = 0;
+	for (;;)
+	{
+		const std::function<void(int64_t, int)>* f;
+		{
+			std::unique_lock<std::mutex> lock(m);
+			cv_start.wait(lock, [&]{ return stop || generation != seen; });
+			if (stop) return;
+			seen = generation;
+			f = job;
+		}
+
+		int64_t i;
+		while (next(id, i))
+			(*f)(i, id);
+
+		std::lock_guard<std::mutex> lock(m);
+		if (--active == 0)
+			cv_done.notify_all();
+	}
+}
+
+//========================================================================
+
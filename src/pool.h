@@ -0,0 +1,72 @@
+
+//========================================================================
+//
+// A small work-stealing thread pool
+//
+//========================================================================
+
+#ifndef TETRIS_POOL_H
+#define TETRIS_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+//========================================================================
+
+class ThreadPool
+{
+	public:
+
+		// Start nthreads workers, or one per core if nthreads <= 0
+		ThreadPool(int nthreads = 0);
+		~ThreadPool();
+
+		int size() const
+		{
+			return (int) workers.size();
+		}
+
+		// Call f(i, thread) for every i in [0, n) and wait for all of them.
+		// thread is in [0, size()), so callers can keep per-thread state
+		// without locking.  Each worker starts with an even slice of [0, n)
+		// and takes indices from the front of it.  A worker that runs out
+		// steals the back half of another worker's slice, so uneven items
+		// (long and short games) still balance out.  Calls from different
+		// threads take turns, and f must not call parallelFor() itself
+		void parallelFor(int64_t n, const std::function<void(int64_t, int)>& f);
+
+	private:
+
+		// Index range owned by one worker
+		struct Slice
+		{
+			std::mutex m;
+			int64_t lo = 0, hi = 0;
+		};
+
+		std::vector<std::thread> workers;
+		std::vector<std::unique_ptr<Slice>> slices;
+
+		// Held for a whole parallelFor() call
+		std::mutex caller;
+
+		std::mutex m;
+		std::condition_variable cv_start, cv_done;
+		const std::function<void(int64_t, int)>* job = nullptr;
+		int64_t generation = 0;
+		int active = 0;
+		bool stop = false;
+
+		void work(int id);
+		bool next(int id, int64_t& i);
+};
+
+//========================================================================
+
+#endif
+
@@ -0,0 +1,454 @@
+
+//========================================================================
+//
+// Profiler
+//
+//========================================================================
+
+#include <profile.h>
+
+#if defined(TETRIS_PROFILE)
+
+// OpenGL
+#include <glad/gl.h>
+
+// Standard
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+// 3P
+#include <fmt/core.h>
+
+// Tetris
+#include <log.h>
+#include <simthread.h>
+
+//========================================================================
+
+namespace
+{
+
+const char* PHASE_NAMES[NPHASES] =
+{
+	"frame", "textures", "background", "board", "pieces", "blocks", "hud",
+	"swap", "tick", "ai"
+};
+
+// Percentiles are over this many of the latest samples of each phase
+const int NSAMPLES = 256;
+
+// GPU timings are read this many frames late, so reading them never stalls
+const int GPU_LAG = 4;
+
+// About 24 MB of trace, or a few minutes at a few thousand events per second
+const size_t MAX_TRACE_EVENTS = 1 << 20;
+
+// Thread id for GPU events in traces
+const int GPU_TID = 0;
+
+struct Rolling
+{
+	std::array<float, NSAMPLES> v = {};
+	int n = 0, i = 0;
+
+	void add(float x)
+	{
+		v[i] = x;
+		i = (i + 1) % NSAMPLES;
+		n = std::min(n + 1, NSAMPLES);
+	}
+};
+
+struct Percentiles
+{
+	float p50 = 0, p95 = 0, p99 = 0;
+	int n = 0;
+};
+
+Percentiles percentiles(const Rolling& r)
+{
+	Percentiles p;
+	p.n = r.n;
+	if (r.n == 0) return p;
+
+	std::array<float, NSAMPLES> v = r.v;
+	std::sort(v.begin(), v.begin() + r.n);
+	auto at = [&](double q)
+	{
+		return v[std::min(r.n - 1, (int) (q * r.n))];
+	};
+	p.p50 = at(0.50);
+	p.p95 = at(0.95);
+	p.p99 = at(0.99);
+	return p;
+}
+
+struct TraceEvent
+{
+	double t0, dur;  // seconds by steadyTime()
+	uint8_t phase;
+	uint8_t tid;
+};
+
+// Timestamp queries for one frame, two per phase
+struct GpuFrame
+{
+	std::array<std::array<GLuint, 2>, NPHASES> q = {};
+	std::array<bool, NPHASES> used = {};
+
+	// steadyTime() minus GPU time, in seconds, as of this frame
+	double offset = 0;
+};
+
+// Everything that more than one thread touches is under m
+std::mutex m;
+std::array<Rolling, NPHASES> cpu, gpu;
+std::vector<TraceEvent> trace;
+bool tracing = false;
+std::vector<std::string> thread_names = {"gpu"};
+
+std::atomic<bool> hud_on{false};
+
+// Render thread only
+std::array<GpuFrame, GPU_LAG> gpu_frames;
+int gpu_frame = -1;
+bool gpu_ok = false;
+
+thread_local int tid = -1;
+
+//========================================================================
+
+int threadId()
+{
+	if (tid < 0)
+		profThread("unnamed");
+	return tid;
+}
+
+//========================================================================
+
+void record(ProfPhase phase, double t0, double dur, bool on_gpu)
+{
+	int id = on_gpu ? GPU_TID : threadId();
+
+	std::lock_guard<std::mutex> lock(m);
+	(on_gpu ? gpu : cpu)[phase].add((float) (1e3 * dur));
+
+	if (tracing && trace.size() < MAX_TRACE_EVENTS)
+		trace.push_back({t0, dur, (uint8_t) phase, (uint8_t) id});
+}
+
+//========================================================================
+
+void writeTrace(const std::vector<TraceEvent>& events,
+		const std::vector<std::string>& names)
+{
+	std::string path = fmt::format("build/trace-{}.json", (int64_t) time(NULL));
+	FILE* f = fopen(path.c_str(), "w");
+	if (!f)
+	{
+		logerr("Error: cannot write trace " + path);
+		return;
+	}
+
+	// Chrome's trace event format:  complete ("X") events with times in us,
+	// and metadata ("M") events to name the threads
+	fmt::print(f, "{{\"traceEvents\":[\n");
+	for (size_t i = 0; i < names.size(); i++)
+		fmt::print(f, "{{\"ph\":\"M\",\"pid\":1,\"tid\":{},\"name\":\"thread_name\",\"args\":{{\"name\":\"{}\"}}}},\n",
+				i, names[i]);
+
+	double t0 = events.empty() ? 0 : events[0].t0;
+	for (auto& e: events)
+		t0 = std::min(t0, e.t0);
+
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const TraceEvent& e = events[i];
+		fmt::print(f, "{{\"ph\":\"X\",\"pid\":1,\"tid\":{},\"name\":\"{}\",\"ts\":{:.3f},\"dur\":{:.3f}}}{}\n",
+				e.tid, PHASE_NAMES[e.phase], 1e6 * (e.t0 - t0), 1e6 * e.dur,
+				i + 1 < events.size() ? "," : "");
+	}
+	fmt::print(f, "]}}\n");
+	fclose(f);
+
+	log(fmt::format("wrote {} trace events to {}", events.size(), path));
+}
+
+//========================================================================
+
+// 3x5 pixel font for the HUD.  Each glyph is 5 rows top to bottom, one octal
+// digit per row, with the high bit on the left
+const char FONT_CHARS[] = "0123456789abcdefghijklmnopqrstuvwxyz.:%-/";
+const uint16_t FONT[] =
+{
+	075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757,
+	075717,
+
+	025755, 065656, 034443, 065556, 074647, 074644, 034553, 055755, 072227,
+	011152, 055655, 044447, 057755, 065555, 025552, 065644, 025563, 065655,
+	034216, 072222, 055557, 055552, 055775, 055255, 055222, 071247,
+
+	000002, 002020, 051245, 000700, 011244
+};
+
+void textQuads(float x, float y, float s, const std::string& str,
+		std::vector<GLfloat>& v)
+{
+	// Append quads for str with its top left corner at (x, y), in pixels
+	// with y down, with s pixels per font pixel.  Unknown characters are
+	// blank
+
+	for (char c: str)
+	{
+		const char* p = strchr(FONT_CHARS, c);
+		if (c && p)
+		{
+			uint16_t g = FONT[p - FONT_CHARS];
+			for (int row = 0; row < 5; row++)
+				for (int col = 0; col < 3; col++)
+				{
+					if (!(g >> (3 * (4 - row) + 2 - col) & 1)) continue;
+
+					float x0 = x + s * col, y0 = y + s * row;
+					v.insert(v.end(), {x0, y0,  x0 + s, y0,  x0 + s, y0 + s,
+							x0, y0 + s});
+				}
+		}
+		x += 4 * s;
+	}
+}
+
+//========================================================================
+
+void drawRect(float x0, float y0, float x1, float y1)
+{
+	glBegin(GL_QUADS);
+	glVertex2f(x0, y0);
+	glVertex2f(x1, y0);
+	glVertex2f(x1, y1);
+	glVertex2f(x0, y1);
+	glEnd();
+}
+
+}
+
+//========================================================================
+
+ProfScope::ProfScope(ProfPhase phase_, bool gpu_) : phase(phase_),
+		gpu(gpu_ && gpu_ok && gpu_frame >= 0)
+{
+	if (gpu)
+	{
+		GpuFrame& f = gpu_frames[gpu_frame];
+		if (f.used[phase])
+			gpu = false;
+		else
+		{
+			f.used[phase] = true;
+			glQueryCounter(f.q[phase][0], GL_TIMESTAMP);
+		}
+	}
+	t0 = steadyTime();
+}
+
+//========================================================================
+
+ProfScope::~ProfScope()
+{
+	record(phase, t0, steadyTime() - t0, false);
+	if (gpu)
+		glQueryCounter(gpu_frames[gpu_frame].q[phase][1], GL_TIMESTAMP);
+}
+
+//========================================================================
+
+void profThread(const char* name)
+{
+	std::lock_guard<std::mutex> lock(m);
+	tid = (int) thread_names.size();
+	thread_names.push_back(name);
+}
+
+//========================================================================
+
+void profFrame()
+{
+	if (gpu_frame < 0)
+	{
+		// Timestamp queries are core in GL 3.3
+		gpu_ok = GLAD_GL_VERSION_3_3;
+		if (gpu_ok)
+			for (auto& f: gpu_frames)
+				glGenQueries(2 * NPHASES, f.q[0].data());
+		gpu_frame = 0;
+	}
+	else
+		gpu_frame = (gpu_frame + 1) % GPU_LAG;
+
+	if (!gpu_ok) return;
+
+	// Collect the results from GPU_LAG frames ago before reusing its queries.
+	// If the GPU still isn't done with them, they're dropped
+	GpuFrame& f = gpu_frames[gpu_frame];
+	for (int p = 0; p < NPHASES; p++)
+	{
+		if (!f.used[p]) continue;
+		f.used[p] = false;
+
+		GLint done = 0;
+		glGetQueryObjectiv(f.q[p][1], GL_QUERY_RESULT_AVAILABLE, &done);
+		if (!done) continue;
+
+		GLuint64 t0, t1;
+		glGetQueryObjectui64v(f.q[p][0], GL_QUERY_RESULT, &t0);
+		glGetQueryObjectui64v(f.q[p][1], GL_QUERY_RESULT, &t1);
+		record((ProfPhase) p, f.offset + 1e-9 * t0, 1e-9 * (t1 - t0), true);
+	}
+
+	// Line the GPU clock up with ours, for traces.  Asking for the GPU time
+	// can sync with it, so only bother while tracing
+	bool t;
+	{
+		std::lock_guard<std::mutex> lock(m);
+		t = tracing;
+	}
+	if (t)
+	{
+		GLint64 now = 0;
+		glGetInteger64v(GL_TIMESTAMP, &now);
+		f.offset = steadyTime() - 1e-9 * now;
+	}
+}
+
+//========================================================================
+
+void profDrawHud(int width, int height)
+{
+	if (!hud_on) return;
+
+	PROF_GPU_SCOPE(PROF_HUD);
+
+	const float S = 2, LINE = 7 * S, MARGIN = 8;
+	const float BAR_X = MARGIN + 4 * S * 54, BAR_MS = 20, BAR_MAX = 17;
+
+	// Text is refreshed a few times a second so it can be read, and it's
+	// kept as quads in between
+	static std::vector<GLfloat> text;
+	static std::array<Percentiles, NPHASES> bars;
+	static double t_refresh = 0;
+
+	double now = steadyTime();
+	if (now - t_refresh >= 0.25)
+	{
+		t_refresh = now;
+
+		std::array<Rolling, NPHASES> c, g;
+		{
+			std::lock_guard<std::mutex> lock(m);
+			c = cpu;
+			g = gpu;
+		}
+
+		auto columns = [](const Percentiles& p, int w)
+		{
+			if (p.n == 0)
+				return fmt::format("{:>{}}{:>6}{:>6}", "-", w, "-", "-");
+			return fmt::format("{:>{}.2f}{:>6.2f}{:>6.2f}", p.p50, w, p.p95,
+					p.p99);
+		};
+
+		text.clear();
+		textQuads(MARGIN, MARGIN, S,
+				"ms         cpu p50   p95   p99   gpu p50   p95   p99", text);
+		for (int i = 0; i < NPHASES; i++)
+		{
+			Percentiles pc = percentiles(c[i]), pg = percentiles(g[i]);
+			bars[i] = pc;
+			textQuads(MARGIN, MARGIN + LINE * (i + 1), S, fmt::format("{:<10}{}{}",
+					PHASE_NAMES[i], columns(pc, 8), columns(pg, 10)), text);
+		}
+	}
+
+	// Pixel coordinates with y down
+	glViewport(0, 0, width, height);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0, width, height, 0, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	glDisable(GL_LIGHTING);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_TEXTURE_2D);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glColor4f(0, 0, 0, 0.6f);
+	drawRect(0, 0, BAR_X + BAR_MS * BAR_MAX + MARGIN,
+			2 * MARGIN + LINE * (NPHASES + 1));
+
+	// Bars for the CPU p50 and p95, up to BAR_MAX ms
+	for (int i = 0; i < NPHASES; i++)
+	{
+		float y = MARGIN + LINE * (i + 1);
+		glColor4f(0.2f, 0.8f, 0.4f, 0.4f);
+		drawRect(BAR_X, y, BAR_X + BAR_MS * std::min(bars[i].p95, BAR_MAX),
+				y + 5 * S);
+		glColor4f(0.2f, 0.8f, 0.4f, 1);
+		drawRect(BAR_X, y, BAR_X + BAR_MS * std::min(bars[i].p50, BAR_MAX),
+				y + 5 * S);
+	}
+
+	glColor4f(1, 1, 1, 1);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, text.data());
+	glDrawArrays(GL_QUADS, 0, (GLsizei) (text.size() / 2));
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	glDisable(GL_BLEND);
+}
+
+//========================================================================
+
+void profToggleHud()
+{
+	hud_on = !hud_on;
+}
+
+//========================================================================
+
+void profToggleTrace()
+{
+	std::vector<TraceEvent> events;
+	std::vector<std::string> names;
+	{
+		std::lock_guard<std::mutex> lock(m);
+		tracing = !tracing;
+		if (tracing)
+		{
+			trace.clear();
+			log("recording trace");
+			return;
+		}
+
+		events.swap(trace);
+		names = thread_names;
+	}
+
+	// Write it outside the lock, so nothing waits on the disk
+	writeTrace(events, names);
+}
+
+//========================================================================
+
+#endif
+
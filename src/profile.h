@@ -0,0 +1,92 @@
+
+//========================================================================
+//
+// Profiler:  scoped CPU timers and GL timer queries around each phase of a
+// frame or a tick, an on-screen HUD with rolling percentiles, and a Chrome
+// trace export (load it in chrome://tracing or ui.perfetto.dev).  Without
+// TETRIS_PROFILE all of it compiles out, down to the last timer
+//
+//========================================================================
+
+#ifndef TETRIS_PROFILE_H
+#define TETRIS_PROFILE_H
+
+//========================================================================
+
+// Everything that gets timed
+enum ProfPhase
+{
+	// Render thread
+	PROF_FRAME,       // all of drawFrame()
+	PROF_TEXTURES,    // texture streaming
+	PROF_BACKGROUND,  // gradient background
+	PROF_BOARD,       // boundary and grid lines
+	PROF_PIECES,      // active piece and preview
+	PROF_BLOCKS,      // settled blocks
+	PROF_HUD,         // this profiler's own overlay
+	PROF_SWAP,        // glfwSwapBuffers(), including any wait for vsync
+
+	// Game thread
+	PROF_TICK,        // one whole tick
+	PROF_AI,          // the autoplayer's part of a tick
+
+	NPHASES
+};
+
+#if defined(TETRIS_PROFILE)
+
+// Times its own lifetime as phase, on the CPU, and also on the GPU if gpu is
+// set.  GPU timing is for the render thread only
+class ProfScope
+{
+	public:
+
+		ProfScope(ProfPhase phase, bool gpu = false);
+		~ProfScope();
+
+	private:
+
+		ProfPhase phase;
+		bool gpu;
+		double t0;
+};
+
+#define PROF_CONCAT_(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT_(a, b)
+
+#define PROF_SCOPE(phase)     ProfScope PROF_CONCAT(prof_scope_, __LINE__)(phase)
+#define PROF_GPU_SCOPE(phase) ProfScope PROF_CONCAT(prof_scope_, __LINE__)(phase, true)
+
+// Name the calling thread in traces
+void profThread(const char* name);
+
+// Start a frame on the render thread:  collect finished GPU timings from a
+// few frames ago.  Needs a current context
+void profFrame();
+
+// Draw the HUD, if it's on, over the top left of a width x height viewport
+void profDrawHud(int width, int height);
+
+// Show or hide the HUD.  Any thread
+void profToggleHud();
+
+// Start recording a trace, or stop and write it to build/.  Any thread
+void profToggleTrace();
+
+#else
+
+#define PROF_SCOPE(phase)
+#define PROF_GPU_SCOPE(phase)
+
+inline void profThread(const char*) {}
+inline void profFrame() {}
+inline void profDrawHud(int, int) {}
+inline void profToggleHud() {}
+inline void profToggleTrace() {}
+
+#endif
+
+//========================================================================
+
+#endif
+
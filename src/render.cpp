@@ -0,0 +1,443 @@
+
+//========================================================================
+//
+// Renderer for the settled blocks and grid lines
+//
+//========================================================================
+
+#include <render.h>
+
+#include <algorithm>
+#include <stddef.h>
+#include <string>
+
+#include <fmt/core.h>
+
+#include <log.h>
+
+//========================================================================
+
+// Hack z-fighting by drawing blocks slightly smaller than 1 unit.  It's
+// noticeble on blocks in single pieces, not just neighboring pieces.
+const float HI = 0.95f;
+const float LO = 1 - HI;
+
+// Both the CW/CCW ordering of vertices and the normal are important.  The CW
+// ordering determines backface culling, while the normal determines lighting
+const std::array<CubeVertex, 24> CUBE =
+{{
+	{HI, LO, HI,   1,  0,  0,   0, TC},
+	{HI, HI, HI,   1,  0,  0,  TC, TC},
+	{HI, HI, LO,   1,  0,  0,  TC,  0},
+	{HI, LO, LO,   1,  0,  0,   0,  0},
+
+	{LO, HI, HI,   0,  0,  1,   0, TC},
+	{HI, HI, HI,   0,  0,  1,  TC, TC},
+	{HI, LO, HI,   0,  0,  1,  TC,  0},
+	{LO, LO, HI,   0,  0,  1,   0,  0},
+
+	{LO, LO, LO,  -1,  0,  0,   0, TC},
+	{LO, HI, LO,  -1,  0,  0,  TC, TC},
+	{LO, HI, HI,  -1,  0,  0,  TC,  0},
+	{LO, LO, HI,  -1,  0,  0,   0,  0},
+
+	{LO, LO, LO,   0,  0, -1,   0, TC},
+	{HI, LO, LO,   0,  0, -1,  TC, TC},
+	{HI, HI, LO,   0,  0, -1,  TC,  0},
+	{LO, HI, LO,   0,  0, -1,   0,  0},
+
+	{HI, HI, LO,   0,  1,  0,   0, TC},
+	{HI, HI, HI,   0,  1,  0,  TC, TC},
+	{LO, HI, HI,   0,  1,  0,  TC,  0},
+	{LO, HI, LO,   0,  1,  0,   0,  0},
+
+	{LO, LO, LO,   0, -1,  0,   0, TC},
+	{LO, LO, HI,   0, -1,  0,  TC, TC},
+	{HI, LO, HI,   0, -1,  0,  TC,  0},
+	{HI, LO, LO,   0, -1,  0,   0,  0},
+}};
+
+//========================================================================
+
+// Generic attribute locations
+enum {ATTR_POS, ATTR_NORMAL, ATTR_UV, ATTR_INST};
+
+// GLSL 1.30 (compatibility) so that the shaders can read the fixed function
+// matrices, light, and material, which the rest of the scene still uses, and
+// can sample array textures.
+//
+// Each shader is compiled twice, with TEXTURED 0 and 1, instead of branching
+// on a uniform.  On llvmpipe the branch, the texture lookup, and the texture
+// coordinate varyings cost every fragment even when textures are off, and
+// fragments are most of the frame.  That was enough to make the instanced
+// board slower than immediate mode despite submitting in a fraction of the
+// time
+const char* VERT_SRC = R"(
+#version 130
+
+in vec3 pos;
+in vec3 normal;
+in vec2 uv;
+
+// Block min corner x, y, and piece type
+in vec3 inst;
+
+out vec4 color;
+
+#if TEXTURED
+out vec2 texcoord;
+flat out float layer;
+#else
+uniform vec4 colors[NTYPES];
+#endif
+
+void main()
+{
+	vec4 p = gl_ModelViewMatrix * vec4(pos + vec3(inst.xy, 0.0), 1.0);
+	gl_Position = gl_ProjectionMatrix * p;
+
+#if TEXTURED
+	vec4 diffuse = vec4(1.0);
+#else
+	vec4 diffuse = colors[int(inst.z)];
+#endif
+
+	// Per-vertex lighting like the fixed function pipeline, with light 1 only
+	// and a non-local viewer
+	vec3 n = normalize(gl_NormalMatrix * normal);
+	vec3 l = normalize(gl_LightSource[1].position.xyz - p.xyz);
+	float nl = max(dot(n, l), 0.0);
+	float spec = 0.0;
+	if (nl > 0.0)
+		spec = pow(max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0),
+				gl_FrontMaterial.shininess);
+
+	color = (gl_LightModel.ambient + gl_LightSource[1].ambient)
+			* gl_FrontMaterial.ambient
+		+ nl * gl_LightSource[1].diffuse * diffuse
+		+ spec * gl_LightSource[1].specular * gl_FrontMaterial.specular;
+	color.a = diffuse.a;
+
+#if TEXTURED
+	texcoord = uv;
+	layer = inst.z;
+#endif
+}
+)";
+
+const char* FRAG_SRC = R"(
+#version 130
+
+in vec4 color;
+
+#if TEXTURED
+uniform sampler2DArray tex;
+
+in vec2 texcoord;
+flat in float layer;
+#endif
+
+void main()
+{
+#if TEXTURED
+	gl_FragColor = color * texture(tex, vec3(texcoord, layer));
+#else
+	gl_FragColor = color;
+#endif
+}
+)";
+
+//========================================================================
+
+GLuint compileShader(GLenum type, const std::string& src)
+{
+	GLuint s = glCreateShader(type);
+	const char* c = src.c_str();
+	glShaderSource(s, 1, &c, NULL);
+	glCompileShader(s);
+
+	GLint status;
+	glGetShaderiv(s, GL_COMPILE_STATUS, &status);
+	if (!status)
+	{
+		char msg[1024];
+		glGetShaderInfoLog(s, sizeof(msg), NULL, msg);
+		logerr(fmt::format("Error: shader compilation failed:\n{}", msg));
+		glDeleteShader(s);
+		return 0;
+	}
+	return s;
+}
+
+//========================================================================
+
+GLuint createProgram(bool textured,
+		const std::vector<std::vector<GLfloat>>& colors)
+{
+	// The shaders are otherwise fixed, but they need to know how many colors
+	// there are and which variant to be.  Insert the defines after the
+	// #version line
+	std::string def = fmt::format("#define NTYPES {}\n#define TEXTURED {}\n",
+			(int) NTYPES, (int) textured);
+	std::string vs = VERT_SRC, fs = FRAG_SRC;
+	vs.insert(vs.find('\n', 1) + 1, def);
+	fs.insert(fs.find('\n', 1) + 1, def);
+
+	GLuint v = compileShader(GL_VERTEX_SHADER, vs);
+	GLuint f = compileShader(GL_FRAGMENT_SHADER, fs);
+	if (!v || !f) return 0;
+
+	GLuint prog = glCreateProgram();
+	glAttachShader(prog, v);
+	glAttachShader(prog, f);
+	glBindAttribLocation(prog, ATTR_POS   , "pos");
+	glBindAttribLocation(prog, ATTR_NORMAL, "normal");
+	glBindAttribLocation(prog, ATTR_UV    , "uv");
+	glBindAttribLocation(prog, ATTR_INST  , "inst");
+	glLinkProgram(prog);
+	glDeleteShader(v);
+	glDeleteShader(f);
+
+	GLint status;
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if (!status)
+	{
+		char msg[1024];
+		glGetProgramInfoLog(prog, sizeof(msg), NULL, msg);
+		logerr(fmt::format("Error: shader linking failed:\n{}", msg));
+		glDeleteProgram(prog);
+		return 0;
+	}
+
+	// Uniforms that never change
+	glUseProgram(prog);
+	if (textured)
+		glUniform1i(glGetUniformLocation(prog, "tex"), 0);
+	else
+	{
+		std::vector<GLfloat> c;
+		for (int t = 0; t < NTYPES; t++)
+			c.insert(c.end(), colors[t].begin(), colors[t].begin() + 4);
+		glUniform4fv(glGetUniformLocation(prog, "colors"), NTYPES, c.data());
+	}
+	glUseProgram(0);
+
+	return prog;
+}
+
+//========================================================================
+
+GLuint BoardRenderer::createVao(GLuint& vbo, GLsizeiptr size, GLenum usage)
+{
+	// A VAO drawing the cube mesh once per instance from a new instance
+	// buffer vbo
+
+	GLuint v;
+	glGenVertexArrays(1, &v);
+	glBindVertexArray(v);
+
+	// The element buffer binding is part of the VAO state
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_cube);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_cube);
+
+	const GLsizei sv = sizeof(CubeVertex);
+	glVertexAttribPointer(ATTR_POS   , 3, GL_FLOAT, GL_FALSE, sv,
+			(void*) offsetof(CubeVertex, x));
+	glVertexAttribPointer(ATTR_NORMAL, 3, GL_FLOAT, GL_FALSE, sv,
+			(void*) offsetof(CubeVertex, nx));
+	glVertexAttribPointer(ATTR_UV    , 2, GL_FLOAT, GL_FALSE, sv,
+			(void*) offsetof(CubeVertex, s));
+	glEnableVertexAttribArray(ATTR_POS);
+	glEnableVertexAttribArray(ATTR_NORMAL);
+	glEnableVertexAttribArray(ATTR_UV);
+
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, usage);
+	glVertexAttribPointer(ATTR_INST, 3, GL_FLOAT, GL_FALSE,
+			sizeof(BlockInstance), (void*) 0);
+	glVertexAttribDivisor(ATTR_INST, 1);
+	glEnableVertexAttribArray(ATTR_INST);
+
+	glBindVertexArray(0);
+	return v;
+}
+
+//========================================================================
+
+bool BoardRenderer::init(const std::vector<std::vector<GLfloat>>& colors)
+{
+	if (!GLAD_GL_VERSION_3_3)
+	{
+		log("GL 3.3 is not available, falling back to immediate mode blocks");
+		return false;
+	}
+
+	// Plain colors, and textures if they ever show up.  Without the textured
+	// program the blocks just stay colored
+	prog     = createProgram(false, colors);
+	prog_tex = createProgram(true , colors);
+	if (!prog) return false;
+
+	// Split each quad into triangles 0 1 2 and 0 2 3, keeping the winding.
+	// Indexed, so that each of the 24 vertices is only shaded once
+	std::vector<GLubyte> tris;
+	for (int i = 0; i < (int) CUBE.size(); i += 4)
+		for (int k: {0, 1, 2, 0, 2, 3})
+			tris.push_back((GLubyte) (i + k));
+
+	glGenBuffers(1, &vbo_cube);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_cube);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE), CUBE.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &ibo_cube);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_cube);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, tris.size(), tris.data(),
+			GL_STATIC_DRAW);
+
+	// One instance per settled block.  The buffer is sized for a full grid up
+	// front so that updates never reallocate it.  The moving blocks get
+	// a small buffer of their own that's refilled every frame
+	vao     = createVao(vbo_inst, sizeof(instances), GL_DYNAMIC_DRAW);
+	vao_dyn = createVao(vbo_dyn , 0                , GL_STREAM_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// Force a full upload on the first update
+	row_generation.fill(UINT64_MAX);
+
+	log("Instanced board renderer ready");
+	return true;
+}
+
+//========================================================================
+
+void BoardRenderer::setLines(const std::vector<GLfloat>& xyz)
+{
+	if (!prog) return;
+
+	if (!vbo_lines) glGenBuffers(1, &vbo_lines);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_lines);
+	glBufferData(GL_ARRAY_BUFFER, xyz.size() * sizeof(GLfloat), xyz.data(),
+			GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	nlines = (GLsizei) (xyz.size() / 3);
+}
+
+//========================================================================
+
+void BoardRenderer::update(const Grid& blocks)
+{
+	if (!prog || blocks.generation == generation) return;
+	generation = blocks.generation;
+
+	// Rebuild the rows that changed.  A settle touches at most NBLOCKS rows,
+	// and a line clear moves everything above the lowest cleared row
+	int iylo = NY;
+	for (int iy = 0; iy < NY; iy++)
+	{
+		if (blocks.row_generation[iy] == row_generation[iy]) continue;
+		row_generation[iy] = blocks.row_generation[iy];
+		iylo = std::min(iylo, iy);
+
+		int n = 0;
+		for (int ix = 0; ix < NX; ix++)
+		{
+			PieceType t = blocks.get(ix, iy);
+			if (t < NTYPES) rows[iy][n++] = {ix + XMIN, iy + YMIN, (float) t};
+		}
+		counts[iy] = n;
+		nrows++;
+	}
+	if (iylo == NY) return;
+
+	// Repack from the lowest changed row up and upload just that tail.  Rows
+	// above a settled piece shift only if the count of a row below changed
+	int lo = 0;
+	for (int iy = 0; iy < iylo; iy++)
+		lo += counts[iy];
+
+	ninstances = lo;
+	for (int iy = iylo; iy < NY; iy++)
+	{
+		std::copy(rows[iy].begin(), rows[iy].begin() + counts[iy],
+				instances.begin() + ninstances);
+		ninstances += counts[iy];
+	}
+
+	if (ninstances > lo)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_inst);
+		glBufferSubData(GL_ARRAY_BUFFER, lo * sizeof(BlockInstance),
+				(ninstances - lo) * sizeof(BlockInstance), &instances[lo]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		nuploads++;
+	}
+}
+
+//========================================================================
+
+void BoardRenderer::setTextures(GLuint t)
+{
+	tex = t;
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+}
+
+//========================================================================
+
+void BoardRenderer::drawInstances(GLuint v, int n, bool textured)
+{
+	if (!prog || n == 0) return;
+
+	glUseProgram(textured && tex && prog_tex ? prog_tex : prog);
+	glBindVertexArray(v);
+
+	glDrawElementsInstanced(GL_TRIANGLES, (GLsizei) (CUBE.size() / 4 * 6),
+			GL_UNSIGNED_BYTE, (void*) 0, n);
+
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+//========================================================================
+
+void BoardRenderer::draw(bool textured)
+{
+	drawInstances(vao, ninstances, textured);
+}
+
+//========================================================================
+
+void BoardRenderer::drawBlocks(const std::vector<BlockInstance>& blocks,
+		bool textured)
+{
+	if (!prog || blocks.empty()) return;
+
+	// Orphan and refill
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_dyn);
+	glBufferData(GL_ARRAY_BUFFER, blocks.size() * sizeof(BlockInstance),
+			blocks.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	drawInstances(vao_dyn, (int) blocks.size(), textured);
+}
+
+//========================================================================
+
+void BoardRenderer::drawLines()
+{
+	if (!vbo_lines) return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_lines);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, (void*) 0);
+	glDrawArrays(GL_LINES, 0, nlines);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//========================================================================
+
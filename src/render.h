@@ -0,0 +1,130 @@
+
+//========================================================================
+//
+// Renderer for the static part of the board, i.e. the settled blocks and the
+// grid lines.  Both live in GPU buffers that are only touched when the grid
+// changes, and then only from the lowest row that changed.  The blocks are one
+// cube mesh in a VBO and one instance per block, drawn with a single call
+//
+//========================================================================
+
+#ifndef TETRIS_RENDER_H
+#define TETRIS_RENDER_H
+
+#include <glad/gl.h>
+
+#include <array>
+#include <stdint.h>
+#include <vector>
+
+#include <grid.h>
+#include <piece.h>
+
+//========================================================================
+
+struct CubeVertex
+{
+	float x, y, z;     // position
+	float nx, ny, nz;  // normal
+	float s, t;        // texture coordinate
+};
+
+// Texture max (1 for full texture on every face)
+const float TC = 0.5f;
+
+// A block with a corner at the origin, as 6 quads of 4 vertices each, CW from
+// the outside.  Shared by the display list and the instanced renderer
+extern const std::array<CubeVertex, 24> CUBE;
+
+// Per-instance data:  the min corner of a block and its piece type, which is
+// also its color index and texture layer
+struct BlockInstance
+{
+	float x, y, t;
+};
+
+//========================================================================
+
+class BoardRenderer
+{
+	public:
+
+		// Compile the shaders and create the buffers.  This needs GL 3.3
+		// (compatibility profile, since lighting still comes from the fixed
+		// function state).  Returns false, and draws nothing, without it
+		bool init(const std::vector<std::vector<GLfloat>>& colors);
+
+		bool ok() const
+		{
+			return prog != 0;
+		}
+
+		// Upload the grid line vertices, as xyz pairs for GL_LINES.  They
+		// never change
+		void setLines(const std::vector<GLfloat>& xyz);
+
+		// Rebuild the rows of blocks that have changed since the last call,
+		// and upload everything from the lowest of them up
+		void update(const Grid& blocks);
+
+		// Use an array texture from a TextureStreamer, with one layer per
+		// piece type.  It's bound here to unit 0's 2D array target, which
+		// nothing else in the scene uses, so this is only called again when
+		// the streamer swaps in a new texture
+		void setTextures(GLuint tex);
+
+		bool textured() const
+		{
+			return tex != 0;
+		}
+
+		// Draw every settled block with the current matrices, light 1, and
+		// material, in one call.  Lit with colors, or textured if textures
+		// are set and textured is true
+		void draw(bool textured);
+
+		// Draw a few moving blocks, e.g. the active piece, the same way.
+		// They're streamed every frame
+		void drawBlocks(const std::vector<BlockInstance>& blocks,
+				bool textured);
+
+		// Draw the cached grid lines with the current color
+		void drawLines();
+
+		// Number of instance buffer uploads, and of rows rebuilt, so far
+		int64_t nuploads = 0, nrows = 0;
+
+	private:
+
+		// Shader programs for colored and textured blocks
+		GLuint prog = 0, prog_tex = 0;
+
+		GLuint vao = 0, vbo_cube = 0, ibo_cube = 0, vbo_inst = 0,
+				vbo_lines = 0, tex = 0;
+		GLsizei nlines = 0;
+
+		// Separate instance buffer and VAO for the moving blocks
+		GLuint vao_dyn = 0, vbo_dyn = 0;
+
+		// Grid generations as of the last upload
+		uint64_t generation = UINT64_MAX;
+		std::array<uint64_t, NY> row_generation;
+
+		// Instances of each row, packed at the start of the row
+		std::array<std::array<BlockInstance, NX>, NY> rows;
+		std::array<int, NY> counts = {};
+
+		// All rows packed back to back, as uploaded.  Row iy starts at
+		// sum(counts[0 .. iy-1]), so rows below the lowest changed row never
+		// move
+		std::array<BlockInstance, NX * NY> instances;
+		int ninstances = 0;
+
+		GLuint createVao(GLuint& vbo, GLsizeiptr size, GLenum usage);
+		void drawInstances(GLuint vao, int n, bool textured);
+};
+
+//========================================================================
+
+#endif
+
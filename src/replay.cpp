@@ -0,0 +1,322 @@
+
+//========================================================================
+//
+// Replays
+//
+// The format, all integers unsigned LEB128 varints unless noted:
+//
+//     "TRPL" version TICK_HZ gravity randomizer seed
+//     record ...
+//
+// Each record starts with (dt << 4) | kind, where dt is the number of ticks
+// since the last record, usually 0 to 7, so that's one byte.  There's a
+// checkpoint every HASH_TICKS, so dt is never more than that.  Kinds below
+// NCMDS are a Command applied in that tick, before it steps, and CMD_MOVETO
+// is followed by its r and ix bytes.  REC_HASH is a checkpoint, followed by
+// the hash chain after that tick's step, and REC_END is the last record,
+// followed by Game::hash() of the end state.  Both hashes are 8 bytes,
+// little endian
+//
+//========================================================================
+
+#include <replay.h>
+
+// Standard
+#include <stdio.h>
+
+// 3P
+#include <fmt/core.h>
+
+// Tetris
+#include <log.h>
+#include <rng.h>
+
+//========================================================================
+
+namespace
+{
+
+const char REPLAY_MAGIC[4] = {'T', 'R', 'P', 'L'};
+// 2 since CMD_MOVETO only goes where the piece can get to
+const uint64_t REPLAY_VERSION = 2;
+
+enum RecordKind : uint8_t
+{
+	REC_HASH = 14,
+	REC_END  = 15
+};
+static_assert((int) NCMDS < (int) REC_HASH, "too many commands for the record kinds");
+
+void putVarint(std::vector<uint8_t>& out, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((uint8_t) (v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t) v);
+}
+
+void put64(std::vector<uint8_t>& out, uint64_t v)
+{
+	for (int i = 0; i < 8; i++)
+		out.push_back((uint8_t) (v >> (8 * i)));
+}
+
+void putRecord(std::vector<uint8_t>& out, int64_t& last, int64_t tick,
+		uint8_t kind)
+{
+	putVarint(out, ((uint64_t) (tick - last) << 4) | kind);
+	last = tick;
+}
+
+// Reads a recording front to back.  Reading past the end sets bad, and
+// returns 0s, so callers only need to check once per record
+struct Reader
+{
+	const std::vector<uint8_t>& data;
+	size_t pos = 0;
+	bool bad = false;
+
+	uint8_t byte()
+	{
+		if (pos >= data.size())
+		{
+			bad = true;
+			return 0;
+		}
+		return data[pos++];
+	}
+
+	uint64_t varint()
+	{
+		uint64_t v = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			uint8_t b = byte();
+			v |= (uint64_t) (b & 0x7f) << shift;
+			if (!(b & 0x80)) return v;
+		}
+		bad = true;
+		return 0;
+	}
+
+	uint64_t u64()
+	{
+		uint64_t v = 0;
+		for (int i = 0; i < 8; i++)
+			v |= (uint64_t) byte() << (8 * i);
+		return v;
+	}
+
+	bool done() const
+	{
+		return pos >= data.size();
+	}
+};
+
+uint64_t chainHash(uint64_t chain, uint64_t hash)
+{
+	uint64_t x = chain ^ hash;
+	return splitmix64(x);
+}
+
+}
+
+//========================================================================
+
+void Recorder::start(uint64_t seed, Randomizer randomizer)
+{
+	data.clear();
+	for (char c: REPLAY_MAGIC)
+		data.push_back((uint8_t) c);
+	putVarint(data, REPLAY_VERSION);
+	putVarint(data, TICK_HZ);
+	putVarint(data, (uint64_t) gravity);
+	data.push_back((uint8_t) randomizer);
+	putVarint(data, seed);
+
+	last = 0;
+	chain = 0;
+}
+
+//========================================================================
+
+void Recorder::command(int64_t tick, const Command& c)
+{
+	putRecord(data, last, tick, c.type);
+	if (c.type == CMD_MOVETO)
+	{
+		data.push_back(c.r);
+		data.push_back(c.ix);
+	}
+}
+
+//========================================================================
+
+void Recorder::tick(int64_t tick, uint64_t hash)
+{
+	chain = chainHash(chain, hash);
+	if (tick % HASH_TICKS) return;
+
+	putRecord(data, last, tick, REC_HASH);
+	put64(data, chain);
+}
+
+//========================================================================
+
+std::vector<uint8_t> Recorder::finish(const Game& game) const
+{
+	std::vector<uint8_t> out = data;
+	int64_t l = last;
+	putRecord(out, l, game.tick, REC_END);
+	put64(out, game.hash());
+	return out;
+}
+
+//========================================================================
+
+bool Recorder::save(const std::string& path, const Game& game) const
+{
+	return saveReplay(path, finish(game));
+}
+
+//========================================================================
+
+bool saveReplay(const std::string& path, const std::vector<uint8_t>& data)
+{
+	FILE* f = fopen(path.c_str(), "wb");
+	bool ok = f && fwrite(data.data(), 1, data.size(), f) == data.size();
+	ok = f && fclose(f) == 0 && ok;
+	if (!ok)
+	{
+		logerr("Error: cannot write replay " + path);
+		return false;
+	}
+
+	log(fmt::format("saved replay {} in {} bytes", path, data.size()));
+	return true;
+}
+
+//========================================================================
+
+bool loadReplay(const std::string& path, std::vector<uint8_t>& data)
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f)
+	{
+		logerr("Error: cannot open replay " + path);
+		return false;
+	}
+
+	data.clear();
+	uint8_t buf[1 << 16];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.insert(data.end(), buf, buf + n);
+
+	bool ok = !ferror(f);
+	fclose(f);
+	if (!ok) logerr("Error: cannot read replay " + path);
+	return ok;
+}
+
+//========================================================================
+
+ReplayResult playReplay(const std::vector<uint8_t>& data, Game& game)
+{
+	ReplayResult res;
+	Reader in{data};
+
+	auto fail = [&](const std::string& error)
+	{
+		res.error = fmt::format("{} at tick {}", error, game.tick);
+		return res;
+	};
+
+	for (char c: REPLAY_MAGIC)
+		if (in.byte() != (uint8_t) c)
+			return fail("not a replay");
+	if (in.varint() != REPLAY_VERSION)
+		return fail("unknown replay version");
+
+	// The recording is only good for the same tick and gravity
+	uint64_t hz = in.varint(), g = in.varint();
+	if (hz != (uint64_t) TICK_HZ || g != (uint64_t) gravity)
+		return fail(fmt::format("recorded at {} Hz with gravity {}, not {} Hz with gravity {}",
+				hz, g, TICK_HZ, gravity));
+
+	uint8_t randomizer = in.byte();
+	uint64_t seed = in.varint();
+	if (in.bad || randomizer > BAG7)
+		return fail("bad replay header");
+
+	game.recorder = nullptr;
+	game.randomizer = static_cast<Randomizer>(randomizer);
+	game.newGame(seed);
+
+	int64_t t = 0;
+	uint64_t chain = 0;
+	while (!in.done())
+	{
+		uint64_t rec = in.varint();
+		uint8_t kind = rec & 0xf;
+
+		// A bigger gap can only be a corrupt record, and stepping through it
+		// could take practically forever
+		uint64_t dt = rec >> 4;
+		if (in.bad) break;
+		if (dt > (uint64_t) HASH_TICKS)
+			return fail("bad record");
+		t += (int64_t) dt;
+
+		// Run the ticks in between
+		while (game.tick < t)
+		{
+			game.step();
+			chain = chainHash(chain, game.hash());
+			res.nticks++;
+		}
+
+		if (kind < NCMDS)
+		{
+			Command c;
+			c.type = static_cast<CmdType>(kind);
+			if (c.type == CMD_MOVETO)
+			{
+				c.r  = in.byte();
+				c.ix = in.byte();
+				if (!in.bad && (c.r >= NROT || c.ix >= NXFULL))
+					return fail("bad record");
+			}
+			if (in.bad) break;
+
+			game.apply(c);
+			res.ncommands++;
+		}
+		else if (kind == REC_HASH)
+		{
+			if (in.u64() != chain && !in.bad)
+				return fail(fmt::format("diverged after tick {}", res.good_tick));
+			res.good_tick = game.tick;
+		}
+		else if (kind == REC_END)
+		{
+			if (in.u64() != game.hash() && !in.bad)
+				return fail(fmt::format("ends differently, diverged after tick {}",
+						res.good_tick));
+			if (in.bad) break;
+
+			res.ok = true;
+			return res;
+		}
+		else
+			return fail(fmt::format("unknown record kind {}", kind));
+
+		if (in.bad) break;
+	}
+	return fail("replay is cut short");
+}
+
+//========================================================================
+
@@ -0,0 +1,80 @@
+
+//========================================================================
+//
+// Replays:  a game recorded as its seed and the commands applied in each
+// tick, in a compact binary stream, and played back headless as fast as the
+// game logic runs.  Every tick's state hash is folded into checkpoints along
+// the way, so a replay that plays out differently is caught within a second
+// of game time of where it went wrong
+//
+//========================================================================
+
+#ifndef TETRIS_REPLAY_H
+#define TETRIS_REPLAY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <game.h>
+
+//========================================================================
+
+// Ticks between checkpoints of the hash chain
+const int HASH_TICKS = TICK_HZ;
+
+// Records a game as it's played.  Set Game::recorder to one before
+// newGame(), and the game reports everything to it
+class Recorder
+{
+	public:
+
+		// The recording so far.  Everything up to the last tick is already
+		// there, so a copy plays back as is
+		std::vector<uint8_t> data;
+
+		// Called by Game
+		void start(uint64_t seed, Randomizer randomizer);
+		void command(int64_t tick, const Command& c);
+		void tick(int64_t tick, uint64_t hash);
+
+		// Write the recording so far to path, with a last record of game's
+		// state, which has to be the game that's being recorded
+		bool save(const std::string& path, const Game& game) const;
+
+		// The recording so far, ending like save() does
+		std::vector<uint8_t> finish(const Game& game) const;
+
+	private:
+
+		// Tick of the last record, and every tick's hash folded together
+		int64_t last = 0;
+		uint64_t chain = 0;
+};
+
+// What playReplay() found
+struct ReplayResult
+{
+	bool ok = false;
+
+	// What went wrong if not ok
+	std::string error;
+
+	// Ticks and commands played, and the last tick whose checkpoint
+	// matched, so a divergence is somewhere in the HASH_TICKS after it
+	int64_t nticks = 0, ncommands = 0, good_tick = 0;
+};
+
+// Play a recording back on game from the start, without pausing between
+// ticks, and check it against every checkpoint and the end state
+ReplayResult playReplay(const std::vector<uint8_t>& data, Game& game);
+
+bool loadReplay(const std::string& path, std::vector<uint8_t>& data);
+
+// Write a finished recording, like Recorder::finish() returns
+bool saveReplay(const std::string& path, const std::vector<uint8_t>& data);
+
+//========================================================================
+
+#endif
+
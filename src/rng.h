@@ -0,0 +1,86 @@
+
+//========================================================================
+//
+// Random numbers for piece generation.  Small, fast, seedable, and owned by
+// each game, so parallel simulations are reproducible and don't contend on
+// the global rand() state
+//
+//========================================================================
+
+#ifndef TETRIS_RNG_H
+#define TETRIS_RNG_H
+
+#include <stdint.h>
+
+//========================================================================
+
+inline uint64_t splitmix64(uint64_t& x)
+{
+	// Used to expand one seed into a full generator state, and to mix seeds
+	uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+//========================================================================
+
+// xoshiro256** by Blackman and Vigna, https://prng.di.unimi.it/
+class Rng
+{
+	public:
+
+		Rng(uint64_t s = 0)
+		{
+			seed(s);
+		}
+
+		void seed(uint64_t s)
+		{
+			for (auto& w: state)
+				w = splitmix64(s);
+		}
+
+		uint64_t operator()()
+		{
+			uint64_t result = rotl(state[1] * 5, 7) * 9;
+			uint64_t t = state[1] << 17;
+
+			state[2] ^= state[0];
+			state[3] ^= state[1];
+			state[1] ^= state[2];
+			state[0] ^= state[3];
+
+			state[2] ^= t;
+			state[3] = rotl(state[3], 45);
+
+			return result;
+		}
+
+		uint32_t below(uint32_t n)
+		{
+			// Random integer in [0, n) by multiply-shift instead of modulo.
+			// The bias is at most n / 2^32, which is nothing for n <= 7
+			return (uint32_t) (((*this)() >> 32) * n >> 32);
+		}
+
+	private:
+
+		uint64_t state[4];
+
+		static uint64_t rotl(uint64_t x, int k)
+		{
+			return (x << k) | (x >> (64 - k));
+		}
+};
+
+//========================================================================
+
+// How a game picks the type of each new piece:  independently at random, or
+// by dealing out shuffled bags holding one of each type
+enum Randomizer {UNIFORM, BAG7};
+
+//========================================================================
+
+#endif
+
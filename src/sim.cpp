@@ -0,0 +1,411 @@
+
+//========================================================================
+//
+// Headless Tetris simulation.  Runs batches of independent games in parallel
+// with the game's fixed tick and scripted or random input, without a window or
+// GL context
+//
+// Usage:
+//
+//     tetris-sim [-n games] [-s seed] [-i script] [-dt seconds] [-t max_ticks]
+//                [-j threads] [-bag] [-ai] [-depth d] [-beam b] [-scaling]
+//                [-check] [-record dir]
+//     tetris-sim -replay file
+//
+// The script is a string of per-tick inputs, repeated as needed:  l/r/d move
+// left/right/down, j/k rotate CCW/CW, h hard drops, and anything else does
+// nothing.  Without a script, input is random.  -bag deals pieces from
+// shuffled 7-bags instead of picking each type independently.  -ai plays with
+// the Autoplayer instead, hard dropping one piece per tick.  -depth sets how
+// many pieces it plans for at once, using the preview, and -beam how many
+// candidates it expands per piece after the first (0 for all).  Games already
+// run in parallel, so each game's lookahead runs on its own thread.
+//
+// Each game stops at game over or after -t ticks, 1000000 by default, or
+// 10000 with -ai, since the autoplayer hardly ever tops out and would
+// otherwise play all 1000000 ticks of every game.
+//
+// Ticks are driven by frames of -dt seconds (one tick by default) through
+// the same FixedStep as the windowed game, and a negative -dt means random
+// frame times up to that long.  -check plays every game at several frame
+// rates and checks that each one ends in exactly the same state, and that its
+// replay plays back the same.  -record saves every game's replay as
+// dir/game-<g>.trpl, and -replay plays one back headless, as fast as it goes,
+// checking it against its recorded state hashes.
+//
+// Game g is seeded with a hash of the seed and g, so results don't depend on
+// the number of threads.  With -scaling, the batch is rerun on 1, 2, 4, ...
+// threads up to -j to report parallel efficiency
+//
+//========================================================================
+
+// Standard
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+// 3P
+#include <fmt/core.h>
+
+// Tetris
+#include <ai.h>
+#include <game.h>
+#include <log.h>
+#include <pool.h>
+#include <replay.h>
+
+//========================================================================
+
+void input(Game& game, char c)
+{
+	// Apply one tick of input, same as key_callback() in the windowed game
+
+	switch (c)
+	{
+		case 'l': game.apply({CMD_LEFT }); break;
+		case 'r': game.apply({CMD_RIGHT}); break;
+		case 'd': game.apply({CMD_DOWN }); break;
+		case 'j': game.apply({CMD_CCW  }); break;
+		case 'k': game.apply({CMD_CW   }); break;
+		case 'h': game.apply({CMD_DROP }); break;
+		default: break;
+	}
+}
+
+//========================================================================
+
+char randomInput(Rng& rng)
+{
+	// Press a random key on about 1 tick in 8.  This draws from a generator of
+	// its own for each game, so each game is reproducible on its own, and
+	// the game's generator only deals pieces, same as in a replay
+	const std::string KEYS = "lrdjk";
+	if (rng.below(8)) return '.';
+	return KEYS[rng.below((uint32_t) KEYS.size())];
+}
+
+//========================================================================
+
+uint64_t gameSeed(uint64_t seed, int64_t g)
+{
+	// Mix the batch seed and game index
+	uint64_t x = (uint64_t) g;
+	x = seed ^ splitmix64(x);
+	return splitmix64(x);
+}
+
+//========================================================================
+
+struct Totals
+{
+	// Aggregated over all games.  Each worker adds once per game with relaxed
+	// atomics, so there's no lock and no contention worth mentioning
+	std::atomic<int64_t> npieces{0}, nlines{0}, nticks{0}, nevals{0},
+		nmismatches{0};
+};
+
+// Default -t, for random or scripted input and for the autoplayer
+const int64_t MAX_TICKS    = 1000000;
+const int64_t AI_MAX_TICKS = 10000;
+
+struct Options
+{
+	int64_t ngames = 1000;
+	int64_t max_ticks = 0;
+	uint64_t seed = 0;
+	Randomizer randomizer = UNIFORM;
+	bool ai = false, check = false;
+	int depth = 1, beam = 8;
+	std::string script, record;
+	double dt = TICK;
+};
+
+// Frame times for -check, in seconds.  Some are shorter than a tick, some
+// aren't a multiple of it, one is past FixedStep's cap, and the last is random
+const std::vector<double> CHECK_FRAMES =
+	{TICK, 1.0 / 60, 1.0 / 144, 1.0 / 30, 1.0 / 7, 0.3, -1.0 / 20};
+
+void playGame(Game& game, Autoplayer& ai, int64_t g, const Options& o,
+		double frame, Recorder* recorder = nullptr)
+{
+	// Play game g to the end, or to max_ticks.  Input is per tick, so frame
+	// only changes how the ticks are bunched up, never the outcome
+
+	game.recorder = recorder;
+	game.randomizer = o.randomizer;
+	game.newGame(gameSeed(o.seed, g));
+
+	// Separate from the game's generator, so random frames can't change it
+	Rng jitter(gameSeed(~o.seed, g));
+	Rng keys(gameSeed(o.seed ^ 0x6b657973, g));
+
+	FixedStep clock;
+	while (!game.over && game.tick < o.max_ticks)
+	{
+		double dt = frame;
+		if (frame < 0)
+			dt = -frame * (jitter() >> 11) * 0x1.0p-53;
+
+		int n = clock.advance(dt);
+		for (int i = 0; i < n && !game.over && game.tick < o.max_ticks; i++)
+		{
+			if (o.ai)
+				ai.update(game);
+			else
+				input(game, o.script.empty() ? randomInput(keys)
+						: o.script[game.tick % o.script.size()]);
+
+			game.step();
+		}
+	}
+}
+
+void runGame(Game& game, int64_t g, const Options& o, Totals& tot)
+{
+	Autoplayer ai;
+	ai.depth = o.depth;
+	ai.beam  = o.beam;
+
+	// Only record when something is going to use it
+	Recorder recorder;
+	bool record = o.check || !o.record.empty();
+	playGame(game, ai, g, o, o.check ? CHECK_FRAMES[0] : o.dt,
+			record ? &recorder : nullptr);
+	game.recorder = nullptr;
+
+	if (!o.record.empty())
+		recorder.save(fmt::format("{}/game-{}.trpl", o.record, g), game);
+
+	if (o.check)
+	{
+		// Play the replay back, without the autoplayer or script
+		Game replayed;
+		ReplayResult rep = playReplay(recorder.finish(game), replayed);
+		if (!rep.ok)
+		{
+			tot.nmismatches.fetch_add(1, std::memory_order_relaxed);
+			logerr(fmt::format("Error: game {} replays differently, {}", g,
+					rep.error));
+		}
+
+		// Replay at every other frame rate and compare the final states
+		uint64_t h = game.hash();
+		for (size_t k = 1; k < CHECK_FRAMES.size(); k++)
+		{
+			Game other;
+			Autoplayer ai_other;
+			ai_other.depth = o.depth;
+			ai_other.beam  = o.beam;
+
+			playGame(other, ai_other, g, o, CHECK_FRAMES[k]);
+			if (other.hash() != h)
+			{
+				tot.nmismatches.fetch_add(1, std::memory_order_relaxed);
+				logerr(fmt::format("Error: game {} ends differently with {} s frames",
+						g, CHECK_FRAMES[k]));
+			}
+		}
+	}
+
+	// ip is the index of the active piece, so it counts the pieces that
+	// settled before it, both at game over, where that piece didn't fit, and
+	// at max_ticks, where it's still falling
+	tot.npieces.fetch_add(game.ip   , std::memory_order_relaxed);
+	tot.nlines .fetch_add(game.lines, std::memory_order_relaxed);
+	tot.nticks .fetch_add(game.tick , std::memory_order_relaxed);
+	tot.nevals .fetch_add(ai.nevals , std::memory_order_relaxed);
+}
+
+//========================================================================
+
+struct Result
+{
+	double secs = 0;
+	int64_t npieces = 0, nlines = 0, nticks = 0, nevals = 0,
+		nmismatches = 0;
+};
+
+Result runBatch(int nthreads, const Options& o)
+{
+	// Run all games on nthreads threads
+
+	ThreadPool pool(nthreads);
+
+	// One game state per thread, reused for each game that thread runs
+	std::vector<Game> games(pool.size());
+	Totals tot;
+
+	auto t0 = std::chrono::steady_clock::now();
+	pool.parallelFor(o.ngames, [&](int64_t g, int thread)
+	{
+		runGame(games[thread], g, o, tot);
+	});
+	auto t1 = std::chrono::steady_clock::now();
+
+	Result res;
+	res.secs    = std::chrono::duration<double>(t1 - t0).count();
+	res.npieces = tot.npieces;
+	res.nlines  = tot.nlines;
+	res.nticks  = tot.nticks;
+	res.nevals  = tot.nevals;
+	res.nmismatches = tot.nmismatches;
+	return res;
+}
+
+//========================================================================
+
+int main(int argc, char* argv[])
+{
+	me = "tetris-sim";
+
+	Options o;
+	o.seed = (uint64_t) time(NULL);
+	int nthreads = 0;
+	bool scaling = false;
+	std::string replay;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-scaling")
+		{
+			scaling = true;
+			continue;
+		}
+		if (arg == "-bag")
+		{
+			o.randomizer = BAG7;
+			continue;
+		}
+		if (arg == "-ai")
+		{
+			o.ai = true;
+			continue;
+		}
+		if (arg == "-check")
+		{
+			o.check = true;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			logerr("Error: missing value for argument " + arg);
+			return EXIT_FAILURE;
+		}
+
+		if      (arg == "-n" ) o.ngames    = atoll(argv[++i]);
+		else if (arg == "-s" ) o.seed      = strtoull(argv[++i], NULL, 0);
+		else if (arg == "-i" ) o.script    = argv[++i];
+		else if (arg == "-dt") o.dt        = atof(argv[++i]);
+		else if (arg == "-t" ) o.max_ticks = atoll(argv[++i]);
+		else if (arg == "-j" ) nthreads    = atoi(argv[++i]);
+		else if (arg == "-depth") o.depth  = atoi(argv[++i]);
+		else if (arg == "-beam" ) o.beam   = atoi(argv[++i]);
+		else if (arg == "-record") o.record = argv[++i];
+		else if (arg == "-replay") replay   = argv[++i];
+		else
+		{
+			logerr("Error: unknown argument " + arg);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!replay.empty())
+	{
+		std::vector<uint8_t> data;
+		if (!loadReplay(replay, data)) return EXIT_FAILURE;
+
+		Game game;
+		quiet = true;
+		auto t0 = std::chrono::steady_clock::now();
+		ReplayResult res = playReplay(data, game);
+		auto t1 = std::chrono::steady_clock::now();
+		quiet = false;
+
+		double secs = std::chrono::duration<double>(t1 - t0).count();
+		log(fmt::format("{} ticks, {} commands, {} pieces, {} lines in {:.3f} s, {:.0f}x real time",
+				res.nticks, res.ncommands, game.ip, game.lines, secs,
+				res.nticks * TICK / std::max(secs, 1e-9)));
+		if (!res.ok)
+		{
+			logerr("Error: replay " + replay + " " + res.error);
+			return EXIT_FAILURE;
+		}
+		log("replay " + replay + " matches");
+		return EXIT_SUCCESS;
+	}
+
+	if (nthreads <= 0)
+		nthreads = std::max(1u, std::thread::hardware_concurrency());
+	if (o.max_ticks <= 0)
+		o.max_ticks = o.ai ? AI_MAX_TICKS : MAX_TICKS;
+	if (o.dt == 0)
+	{
+		logerr("Error: -dt can't be 0");
+		return EXIT_FAILURE;
+	}
+
+	log(fmt::format("games = {}, seed = {}, tick = 1/{} s, dt = {}, max_ticks = {}, input = {}, randomizer = {}",
+			o.ngames, o.seed, TICK_HZ, o.dt, o.max_ticks,
+			o.ai ? "ai" : o.script.empty() ? "random" : o.script,
+			o.randomizer == BAG7 ? "7-bag" : "uniform"));
+
+	// The game logs every game over and line clear, and with a lower
+	// TETRIS_LOG_LEVEL every spawn and settle too.  Only the summary matters
+	// here, so the game threads run quiet and only the main thread logs in
+	// between
+	quiet = true;
+
+	if (!scaling)
+	{
+		Result res = runBatch(nthreads, o);
+
+		quiet = false;
+		log(fmt::format("{} games, {} pieces, {} lines, {} ticks in {:.3f} s on {} thread(s)",
+				o.ngames, res.npieces, res.nlines, res.nticks, res.secs, nthreads));
+		log(fmt::format("{:.1f} games/s, {:.0f} pieces/s, {:.0f} ticks/s",
+				o.ngames / res.secs, res.npieces / res.secs, res.nticks / res.secs));
+		log(fmt::format("{:.1f} pieces/game, {:.2f} lines/game",
+				(double) res.npieces / o.ngames, (double) res.nlines / o.ngames));
+		if (o.ai)
+		{
+			log(fmt::format("{} placements evaluated, {:.0f} placements/s",
+					res.nevals, res.nevals / res.secs));
+			if (o.depth > 1)
+				log(fmt::format("depth = {}, beam = {}, {:.0f} pieces/s",
+						o.depth, o.beam, res.npieces / res.secs));
+		}
+		if (o.check)
+		{
+			log(fmt::format("{} games replayed at {} frame rates and from their recordings, {} mismatch(es)",
+					o.ngames, CHECK_FRAMES.size() - 1, res.nmismatches));
+			if (res.nmismatches > 0)
+				return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// Scaling study:  1, 2, 4, ... threads, and finally nthreads itself
+	double t1 = 0;
+	for (int nt = 1; ; nt = std::min(2 * nt, nthreads))
+	{
+		double secs = runBatch(nt, o).secs;
+		if (nt == 1) t1 = secs;
+
+		quiet = false;
+		log(fmt::format("threads = {:3}, {:9.1f} games/s, speedup {:5.2f}, efficiency {:5.1f}%",
+				nt, o.ngames / secs, t1 / secs, 100 * t1 / (secs * nt)));
+		quiet = true;
+
+		if (nt == nthreads) break;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+//========================================================================
+
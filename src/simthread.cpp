@@ -0,0 +1,308 @@
+
+//========================================================================
+//
+// Game thread
+//
+//========================================================================
+
+#include <simthread.h>
+
+// Standard
+#include <algorithm>
+#include <chrono>
+#include <time.h>
+
+#if defined(_WIN32)
+ #define WIN32_LEAN_AND_MEAN
+ #define NOMINMAX
+ #include <windows.h>
+#else
+ #include <sys/resource.h>
+#endif
+
+// 3P
+#include <fmt/core.h>
+
+// Tetris
+#include <log.h>
+#include <profile.h>
+
+//========================================================================
+
+double steadyTime()
+{
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//========================================================================
+
+double cpuTime()
+{
+#if defined(_WIN32)
+	FILETIME create, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user))
+		return 0;
+
+	// 100 ns units
+	auto secs = [](const FILETIME& f)
+	{
+		return 1e-7 * (((uint64_t) f.dwHighDateTime << 32) | f.dwLowDateTime);
+	};
+	return secs(kernel) + secs(user);
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+		+ 1e-6 * (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+#endif
+}
+
+//========================================================================
+
+SimThread::~SimThread()
+{
+	stop();
+}
+
+//========================================================================
+
+void SimThread::start(uint64_t seed)
+{
+	if (thread.joinable()) return;
+
+	game.recorder = &recorder;
+	game.newGame(seed);
+
+	// Publish the first snapshot from here, so there's something to draw
+	// before the first tick
+	publish(steadyTime());
+
+	stopping = false;
+	thread = std::thread(&SimThread::run, this);
+}
+
+//========================================================================
+
+void SimThread::stop()
+{
+	stopping = true;
+	wake();
+	if (thread.joinable())
+		thread.join();
+}
+
+//========================================================================
+
+void SimThread::input(Key key, bool down)
+{
+	InputEvent e;
+	e.t = steadyTime();
+	e.key = key;
+	e.down = down;
+
+	// 256 events is a couple of seconds of mashing every key, so this only
+	// happens if the game thread is stuck
+	if (!events.push(e))
+		logerr("Error: input queue is full, dropping a key event");
+
+	if (paused())
+		wake();
+}
+
+//========================================================================
+
+void SimThread::pause(PauseReason reason, bool on)
+{
+	if (on)
+		pause_bits |= reason;
+	else
+		pause_bits &= ~reason;
+	wake();
+}
+
+//========================================================================
+
+void SimThread::wake()
+{
+	// Taking the lock means the game thread is either not yet checking for
+	// work, or already waiting, so the notification can't fall in between
+	{
+		std::lock_guard<std::mutex> lock(m);
+	}
+	cv.notify_one();
+}
+
+//========================================================================
+
+void SimThread::apply(const InputEvent& e)
+{
+	input_t = e.t;
+
+	if (e.key == KEY_AI)
+	{
+		if (e.down)
+		{
+			enable_ai = !enable_ai;
+			log(fmt::format("autoplayer {}", enable_ai ? "on" : "off"));
+		}
+		return;
+	}
+
+	if (e.key == KEY_REPLAY)
+	{
+		// Only the game thread can touch the recordings, so this is the
+		// place to save them
+		if (e.down)
+		{
+			int64_t now = (int64_t) time(NULL);
+			recorder.save(fmt::format("build/replay-{}.trpl", now), game);
+			if (!ended.empty())
+				saveReplay(fmt::format("build/replay-{}-ended.trpl", now), ended);
+		}
+		return;
+	}
+
+	keys.update(e.t, game);
+	keys.event(e, game);
+}
+
+//========================================================================
+
+void SimThread::publish(double t)
+{
+	Snapshot& s = snaps.back();
+	s.game = game;
+	s.t = t;
+	s.input_t = input_t;
+	s.seq = ++nsnaps;
+	s.paused = paused();
+	snaps.publish();
+
+	if (on_publish)
+		on_publish();
+}
+
+//========================================================================
+
+void SimThread::idle()
+{
+	// Wait without ticking until unpaused.  Held keys are let go, since their
+	// releases might come while paused, and new presses are dropped so nothing
+	// moves.  The autoplayer can still be toggled, and the replay saved
+
+	keys.reset();
+
+	// Let the renderer know
+	publish(steadyTime());
+
+	std::unique_lock<std::mutex> lock(m);
+	while (paused() && !stopping)
+	{
+		while (const InputEvent* e = events.front())
+		{
+			if (e->key == KEY_AI || e->key == KEY_REPLAY)
+				apply(*e);
+			events.pop();
+		}
+
+		cv.wait(lock, [&]
+		{
+			return !paused() || stopping || events.front();
+		});
+	}
+}
+
+//========================================================================
+
+void SimThread::run()
+{
+	profThread("sim");
+
+	// Tick rate stats, logged every few seconds:  ticks run, time spent in
+	// them, and how late the thread woke up for them
+	double t_stats = steadyTime(), work = 0, late_max = 0;
+	int64_t nticks = 0;
+
+	FixedStep clock;
+	double t0 = steadyTime(), t_wake = t0;
+
+	while (!stopping)
+	{
+		if (paused())
+		{
+			idle();
+
+			// Don't catch up on the time spent paused
+			t0 = t_wake = steadyTime();
+			continue;
+		}
+
+		double t = steadyTime();
+		late_max = std::max(late_max, t - t_wake);
+
+		int n = clock.advance(t - t0);
+		t0 = t;
+
+		for (int i = 0; i < n; i++)
+		{
+			PROF_SCOPE(PROF_TICK);
+
+			// Apply the input from before the end of this tick, and any key
+			// repeats in between, in the order they happened
+			double t_tick = t - clock.acc - (n - 1 - i) * TICK;
+			while (const InputEvent* e = events.front())
+			{
+				if (e->t > t_tick) break;
+				apply(*e);
+				events.pop();
+			}
+			keys.update(t_tick, game);
+
+			if (enable_ai)
+			{
+				PROF_SCOPE(PROF_AI);
+				ai.update(game);
+			}
+
+			game.step();
+
+			// Start over once the stack reaches the top, keeping the
+			// recording of the game that just ended
+			if (game.over)
+			{
+				ended = recorder.finish(game);
+				game.newGame((uint64_t) time(NULL));
+			}
+		}
+
+		double t_done = steadyTime();
+		if (n > 0)
+		{
+			// The state is as of the last whole tick, which isn't quite now
+			publish(t - clock.acc);
+			work += t_done - t;
+			nticks += n;
+		}
+
+		if (t_done - t_stats >= 5.0)
+		{
+			log(fmt::format("sim {:.1f} ticks/s, tick {:.3f} ms, woke up to {:.3f} ms late",
+					nticks / (t_done - t_stats), 1e3 * work / std::max<int64_t>(nticks, 1),
+					1e3 * late_max));
+			t_stats = t_done;
+			work = late_max = 0;
+			nticks = 0;
+		}
+
+		// Sleep until the next tick is due
+		t_wake = t + TICK - clock.acc;
+		std::this_thread::sleep_for(std::chrono::duration<double>(
+				t_wake - steadyTime()));
+	}
+}
+
+//========================================================================
+
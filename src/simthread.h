@@ -0,0 +1,154 @@
+
+//========================================================================
+//
+// The game on its own thread.  It ticks at TICK_HZ in real time, and after
+// every tick publishes a snapshot of the game through a triple buffer, which
+// the render thread reads without locking.  Input goes the other way, as
+// timestamped key events in a lock-free queue, and each tick takes the events
+// from before its end time.  A slow frame or a swap that waits on vsync can't
+// hold up input or gravity, and vice versa
+//
+//========================================================================
+
+#ifndef TETRIS_SIMTHREAD_H
+#define TETRIS_SIMTHREAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include <ai.h>
+#include <game.h>
+#include <input.h>
+#include <replay.h>
+#include <spsc.h>
+#include <triple.h>
+
+//========================================================================
+
+// Seconds on a steady clock, shared by both threads for interpolation
+double steadyTime();
+
+// Seconds of CPU time used so far by the whole process, on every thread
+double cpuTime();
+
+// Everything the render thread gets from one tick
+struct Snapshot
+{
+	Game game;
+
+	// When game was current, by steadyTime().  The active piece is drawn
+	// interpolated over the tick that ended then
+	double t = 0;
+
+	// Time of the newest key event that game includes, for input latency
+	double input_t = 0;
+
+	// Counts up with every snapshot, so the renderer can tell if it's seen
+	// this one already
+	int64_t seq = 0;
+
+	// Set while the game isn't ticking, so nothing moves until the next one
+	bool paused = false;
+
+	// How far the active piece has to be interpolated at time now
+	float alpha(double now) const
+	{
+		float a = (float) ((now - t) / TICK);
+		return a < 0 ? 0 : a > 1 ? 1 : a;
+	}
+};
+
+// Reasons for the game to stop ticking.  Any one of them pauses it
+enum PauseReason
+{
+	PAUSE_PLAYER = 1,  // the player pressed pause
+	PAUSE_HIDDEN = 2   // the window is minimized
+};
+
+//========================================================================
+
+class SimThread
+{
+	public:
+
+		// Plays the game when toggled on.  Set it up before start()
+		Autoplayer ai;
+
+		// Key repeat settings.  Set them before start() too
+		KeyRepeater keys;
+
+		// Called on the game thread after each snapshot is published, e.g.
+		// to wake the renderer.  Set it before start() too
+		std::function<void()> on_publish;
+
+		~SimThread();
+
+		// Start a new game with seed and start ticking
+		void start(uint64_t seed);
+
+		// Finish the current tick and join the thread
+		void stop();
+
+		// Queue a key going down or up now.  Only one thread, the one that
+		// handles window events, may call this
+		void input(Key key, bool down);
+
+		// Set or clear one PauseReason.  While paused, the game thread sleeps
+		// until it's woken, instead of waking up every tick.  Any thread
+		void pause(PauseReason reason, bool on);
+
+		bool paused() const
+		{
+			return pause_bits != 0;
+		}
+
+		// The newest snapshot.  Only the render thread calls this, and the
+		// reference is good until its next call
+		const Snapshot& latest()
+		{
+			snaps.update();
+			return snaps.front();
+		}
+
+	private:
+
+		// Only touched by the game thread once it's started
+		Game game;
+		bool enable_ai = false;
+
+		// Every game is recorded, and KEY_REPLAY saves the one in progress.
+		// A new game starts as soon as one ends, so the recording of the
+		// last one that ended is kept too, and saved along with it
+		Recorder recorder;
+		std::vector<uint8_t> ended;
+
+		TripleBuffer<Snapshot> snaps;
+
+		SpscQueue<InputEvent, 256> events;
+		double input_t = 0;
+		int64_t nsnaps = 0;
+
+		std::thread thread;
+		std::atomic<bool> stopping{false};
+		std::atomic<int> pause_bits{0};
+
+		// Wakes the game thread while it's paused
+		std::mutex m;
+		std::condition_variable cv;
+
+		void run();
+		void idle();
+		void wake();
+		void apply(const InputEvent& e);
+		void publish(double t);
+};
+
+//========================================================================
+
+#endif
+
@@ -0,0 +1,69 @@
+
+//========================================================================
+//
+// Lock-free ring buffer queue for exactly one producer thread and one
+// consumer thread
+//
+//========================================================================
+
+#ifndef TETRIS_SPSC_H
+#define TETRIS_SPSC_H
+
+#include <array>
+#include <atomic>
+#include <stddef.h>
+
+//========================================================================
+
+// N must be a power of 2
+template <typename T, size_t N>
+class SpscQueue
+{
+	static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of 2");
+
+	public:
+
+		// Producer:  returns false, and drops v, if the queue is full
+		bool push(const T& v)
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h - tail.load(std::memory_order_acquire) == N)
+				return false;
+
+			slots[h & (N - 1)] = v;
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer:  the oldest value, or nullptr if the queue is empty.  It
+		// stays valid until pop()
+		const T* front() const
+		{
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t == head.load(std::memory_order_acquire))
+				return nullptr;
+
+			return &slots[t & (N - 1)];
+		}
+
+		// Consumer:  remove the value from front()
+		void pop()
+		{
+			tail.store(tail.load(std::memory_order_relaxed) + 1,
+					std::memory_order_release);
+		}
+
+	private:
+
+		std::array<T, N> slots;
+
+		// Counts of values pushed and popped.  They only ever grow, and are
+		// on separate cache lines so the two threads don't share one
+		alignas(64) std::atomic<size_t> head{0};
+		alignas(64) std::atomic<size_t> tail{0};
+};
+
+//========================================================================
+
+#endif
+
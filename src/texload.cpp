@@ -0,0 +1,696 @@
+
+//========================================================================
+//
+// Texture loading
+//
+//========================================================================
+
+#include <texload.h>
+
+// Standard
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <filesystem>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+ #define WIN32_LEAN_AND_MEAN
+ #define NOMINMAX
+ #include <windows.h>
+#else
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+// 3P
+#include <fmt/core.h>
+#include <lodepng.h>
+
+// Tetris
+#include <log.h>
+
+//========================================================================
+
+// Read-only memory map of a whole file
+class MappedFile
+{
+	public:
+
+		MappedFile() = default;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		~MappedFile()
+		{
+			close();
+		}
+
+		bool open(const std::string& path);
+		void close();
+
+		const unsigned char* data() const
+		{
+			return (const unsigned char*) p;
+		}
+
+		size_t size() const
+		{
+			return n;
+		}
+
+	private:
+
+		void* p = nullptr;
+		size_t n = 0;
+
+#if defined(_WIN32)
+		HANDLE mapping = NULL;
+#endif
+};
+
+//========================================================================
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+#if defined(_WIN32)
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER sz;
+	if (GetFileSizeEx(file, &sz) && sz.QuadPart > 0)
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	// The mapping keeps the file open
+	CloseHandle(file);
+	if (!mapping) return false;
+
+	p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!p)
+	{
+		CloseHandle(mapping);
+		mapping = NULL;
+		return false;
+	}
+	n = (size_t) sz.QuadPart;
+
+#else
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED)
+			p = nullptr;
+		else
+			n = (size_t) st.st_size;
+	}
+
+	// The mapping keeps the file open
+	::close(fd);
+
+#endif
+
+	return p != nullptr;
+}
+
+//========================================================================
+
+void MappedFile::close()
+{
+	if (!p) return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile(p);
+	CloseHandle(mapping);
+	mapping = NULL;
+#else
+	munmap(p, n);
+#endif
+
+	p = nullptr;
+	n = 0;
+}
+
+//========================================================================
+
+// Cache file layout:  this header, then every mip level of the image from
+// level 0 down, tightly packed RGBA8.  The source file's size and time are
+// saved so that a changed PNG is decoded again
+struct CacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t w, h, nlevels, pad;
+	uint64_t src_size, src_time;
+};
+
+const char CACHE_MAGIC[4] = {'T', 'X', 'C', 'H'};
+const uint32_t CACHE_VERSION = 1;
+
+//========================================================================
+
+int mipLevels(int w, int h)
+{
+	// Every level down to 1x1
+	int n = 1;
+	while ((std::max(w, h) >> n) > 0)
+		n++;
+	return n;
+}
+
+size_t mipBytes(int w, int h, int nlevels)
+{
+	size_t n = 0;
+	for (int l = 0; l < nlevels; l++)
+		n += (size_t) std::max(1, w >> l) * std::max(1, h >> l) * 4;
+	return n;
+}
+
+//========================================================================
+
+void buildMips(unsigned char* p, int w, int h, int nlevels)
+{
+	// Fill in levels 1 .. nlevels-1 after level 0 at p, each a 2x2 box
+	// filter of the one before.  Odd edges reuse the last row or column
+
+	for (int l = 1; l < nlevels; l++)
+	{
+		int sw = std::max(1, w >> (l-1)), sh = std::max(1, h >> (l-1));
+		int dw = std::max(1, w >>  l   ), dh = std::max(1, h >>  l   );
+		const unsigned char* src = p;
+		unsigned char* dst = p + (size_t) sw * sh * 4;
+
+		for (int y = 0; y < dh; y++)
+		{
+			int y0 = std::min(2*y, sh - 1), y1 = std::min(2*y + 1, sh - 1);
+			for (int x = 0; x < dw; x++)
+			{
+				int x0 = std::min(2*x, sw - 1), x1 = std::min(2*x + 1, sw - 1);
+				for (int c = 0; c < 4; c++)
+				{
+					int sum = src[((size_t) y0 * sw + x0) * 4 + c]
+					        + src[((size_t) y0 * sw + x1) * 4 + c]
+					        + src[((size_t) y1 * sw + x0) * 4 + c]
+					        + src[((size_t) y1 * sw + x1) * 4 + c];
+					dst[((size_t) y * dw + x) * 4 + c] = (unsigned char) ((sum + 2) / 4);
+				}
+			}
+		}
+		p = dst;
+	}
+}
+
+//========================================================================
+
+// One source image, with every mip level
+struct TexLayer
+{
+	int w = 0, h = 0, nlevels = 0;
+
+	// Every mip level, either mapped from the cache or, if it can't be
+	// cached, decoded into pixels.  Pages of the map are only read in as
+	// levels are needed
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+	bool decoded = false;
+
+	std::vector<unsigned char> pixels;
+	MappedFile map;
+
+	// Set by the pool thread once everything above is filled in, or once it
+	// has failed and data is still null
+	std::atomic<bool> ready{false};
+};
+
+//========================================================================
+
+bool sourceStamp(const std::string& file, uint64_t& size, uint64_t& time)
+{
+	std::error_code ec;
+	size = (uint64_t) std::filesystem::file_size(file, ec);
+	if (ec) return false;
+
+	auto t = std::filesystem::last_write_time(file, ec);
+	if (ec) return false;
+	time = (uint64_t) t.time_since_epoch().count();
+	return true;
+}
+
+std::string cachePath(const std::string& cache_dir, const std::string& file)
+{
+	return cache_dir + "/"
+		+ std::filesystem::path(file).filename().string() + ".txc";
+}
+
+//========================================================================
+
+bool readCache(const std::string& path, uint64_t src_size, uint64_t src_time,
+		TexLayer& layer)
+{
+	if (!layer.map.open(path)) return false;
+
+	CacheHeader hd;
+	if (layer.map.size() < sizeof(hd)) return false;
+	memcpy(&hd, layer.map.data(), sizeof(hd));
+
+	if (memcmp(hd.magic, CACHE_MAGIC, sizeof(hd.magic)) != 0
+			|| hd.version != CACHE_VERSION
+			|| hd.src_size != src_size || hd.src_time != src_time
+			|| hd.nlevels != (uint32_t) mipLevels(hd.w, hd.h)
+			|| layer.map.size() != sizeof(hd) + mipBytes(hd.w, hd.h, hd.nlevels))
+	{
+		layer.map.close();
+		return false;
+	}
+
+	layer.w = hd.w;
+	layer.h = hd.h;
+	layer.nlevels = hd.nlevels;
+	layer.data = layer.map.data() + sizeof(hd);
+	layer.size = mipBytes(hd.w, hd.h, hd.nlevels);
+	return true;
+}
+
+//========================================================================
+
+bool writeCache(const std::string& path, uint64_t src_size,
+		uint64_t src_time, const TexLayer& layer)
+{
+	// Write to a temporary file and rename it, so that a crash or another
+	// instance never sees half a cache file
+	std::string tmp = path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (!f) return false;
+
+	CacheHeader hd = {};
+	memcpy(hd.magic, CACHE_MAGIC, sizeof(hd.magic));
+	hd.version = CACHE_VERSION;
+	hd.w = layer.w;
+	hd.h = layer.h;
+	hd.nlevels = layer.nlevels;
+	hd.src_size = src_size;
+	hd.src_time = src_time;
+
+	bool ok = fwrite(&hd, sizeof(hd), 1, f) == 1
+		&& fwrite(layer.data, 1, layer.size, f) == layer.size;
+	ok = fclose(f) == 0 && ok;
+
+	std::error_code ec;
+	if (ok)
+		std::filesystem::rename(tmp, path, ec);
+	if (!ok || ec)
+	{
+		logerr("Error: cannot write texture cache " + path);
+		std::filesystem::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+//========================================================================
+
+void prepareLayer(const std::string& file, const std::string& cache_dir,
+		TexLayer& layer)
+{
+	// Map every mip level of one image from the cache if it's up to date,
+	// or else decode the PNG and cache it first.  Runs on a pool thread
+
+	uint64_t src_size = 0, src_time = 0;
+	if (!sourceStamp(file, src_size, src_time))
+	{
+		logerr("Error: cannot find texture " + file);
+		return;
+	}
+
+	std::string path = cache_dir.empty() ? "" : cachePath(cache_dir, file);
+	if (!path.empty() && readCache(path, src_size, src_time, layer))
+		return;
+
+	log("decoding " + file);
+
+	unsigned char* px = nullptr;
+	unsigned w, h;
+	unsigned error = lodepng_decode32_file(&px, &w, &h, file.c_str());
+	if (error)
+	{
+		logerr(fmt::format("Error {}: {}", error, lodepng_error_text(error)));
+		free(px);
+		return;
+	}
+
+	layer.w = w;
+	layer.h = h;
+	layer.nlevels = mipLevels(w, h);
+	layer.size = mipBytes(w, h, layer.nlevels);
+	layer.pixels.resize(layer.size);
+	memcpy(layer.pixels.data(), px, (size_t) w * h * 4);
+	free(px);
+
+	buildMips(layer.pixels.data(), w, h, layer.nlevels);
+	layer.data = layer.pixels.data();
+	layer.decoded = true;
+
+	// Swap the decoded copy for a map of the one just written, so that it
+	// only takes memory for the levels in use, same as a cache hit
+	if (!path.empty() && writeCache(path, src_size, src_time, layer)
+			&& readCache(path, src_size, src_time, layer))
+		layer.pixels = std::vector<unsigned char>();
+}
+
+//========================================================================
+
+size_t chainBytes(int w, int h, int nlevels, int level)
+{
+	// Bytes of every level from level down
+	return mipBytes(std::max(1, w >> level), std::max(1, h >> level),
+			nlevels - level);
+}
+
+double steadySecs()
+{
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The first upload is no finer than this, so that something shows up right
+// away.  It's all done in one frame
+const int PLACEHOLDER_SIZE = 64;
+
+//========================================================================
+
+TextureStreamer::TextureStreamer() = default;
+
+TextureStreamer::~TextureStreamer()
+{
+	// GL objects are left alone, since the context may be gone by now
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stop = true;
+	}
+	cv.notify_all();
+
+	if (worker.joinable())
+		worker.join();
+}
+
+//========================================================================
+
+void TextureStreamer::start(const std::vector<std::string>& files_,
+		const std::string& cache_dir_, ThreadPool& pool_, size_t budget_)
+{
+	if (worker.joinable()) return;
+
+	files     = files_;
+	cache_dir = cache_dir_;
+	pool      = &pool_;
+	budget    = budget_;
+	t_start   = steadySecs();
+
+	layers = std::vector<TexLayer>(files.size());
+	uploaded = std::vector<bool>(files.size());
+
+	if (!cache_dir.empty())
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(cache_dir, ec);
+	}
+
+	fetch = fetched = INT_MAX;
+	worker = std::thread(&TextureStreamer::work, this);
+}
+
+//========================================================================
+
+void TextureStreamer::work()
+{
+	// Each layer is handed over as soon as it's prepared, so the GL thread
+	// can upload it while the rest are still decoding
+	pool->parallelFor((int64_t) layers.size(), [&](int64_t i, int)
+	{
+		prepareLayer(files[i], cache_dir, layers[i]);
+		layers[i].ready.store(true, std::memory_order_release);
+	});
+
+	for (;;)
+	{
+		int l;
+		{
+			std::unique_lock<std::mutex> lock(m);
+			cv.wait(lock, [&]{ return stop || fetch < fetched; });
+			if (stop) return;
+			l = fetch;
+		}
+
+		// Touch a byte of every page from level l down to what's already
+		// fetched.  Coarser levels are tiny and the GL thread can fault those
+		// in itself
+		for (auto& layer: layers)
+		{
+			size_t lo = mipBytes(layer.w, layer.h, l);
+			size_t hi = mipBytes(layer.w, layer.h,
+					std::min((int) fetched, layer.nlevels));
+
+			volatile unsigned char sink = 0;
+			for (size_t i = lo; i < hi; i += 4096)
+				sink = sink + layer.data[i];
+		}
+		fetched = l;
+	}
+}
+
+//========================================================================
+
+int TextureStreamer::wantedLevel(float pixels) const
+{
+	// The coarsest level that still has a texel for every pixel
+	int l = 0;
+	while (l < nlevels - 1 && (std::max(w, h) >> (l + 1)) >= pixels)
+		l++;
+
+	// Then coarser still until it fits the budget
+	while (l < nlevels - 1
+			&& layers.size() * chainBytes(w, h, nlevels, l) > budget)
+		l++;
+
+	return l;
+}
+
+//========================================================================
+
+size_t TextureStreamer::residentBytes() const
+{
+	if (!tex) return 0;
+	return layers.size() * chainBytes(w, h, nlevels, base);
+}
+
+//========================================================================
+
+bool TextureStreamer::checkLayer(int i)
+{
+	// Check a newly prepared layer.  The first one sets the size for all of
+	// them, since all layers of an array texture have the same size
+
+	const TexLayer& layer = layers[i];
+	if (!layer.data)
+	{
+		// prepareLayer() has said why
+		failed = true;
+		return false;
+	}
+
+	if (!nlevels)
+	{
+		w = layer.w;
+		h = layer.h;
+		nlevels = layer.nlevels;
+		glGenBuffers(1, &pbo);
+	}
+	else if (layer.w != w || layer.h != h)
+	{
+		logerr(fmt::format("Error: texture {} is {}x{}, expected {}x{}",
+				files[i], layer.w, layer.h, w, h));
+		failed = true;
+		return false;
+	}
+
+	(layer.decoded ? stats.nmisses : stats.nhits)++;
+	return true;
+}
+
+//========================================================================
+
+bool TextureStreamer::update(float pixels)
+{
+	int n = (int) layers.size();
+	if (failed || n == 0) return false;
+
+	if (!tex)
+	{
+		// Placeholder.  It's small, so every layer that's ready goes up right
+		// away, without waiting for the others to finish decoding
+		for (int i = 0; i < n; i++)
+		{
+			if (uploaded[i] || !layers[i].ready.load(std::memory_order_acquire))
+				continue;
+			if (!checkLayer(i)) return false;
+
+			if (!next)
+			{
+				int l = wantedLevel(pixels);
+				while (l < nlevels - 1 && (std::max(w, h) >> l) > PLACEHOLDER_SIZE)
+					l++;
+				beginTexture(l);
+			}
+			uploadLayer(i);
+			uploaded[i] = true;
+			nuploaded++;
+		}
+		if (nuploaded < n) return false;
+
+		finish();
+
+		stats.secs = steadySecs() - t_start;
+		log(fmt::format("First textures in {:.3f} s, {} from cache, {} decoded",
+				stats.secs, stats.nhits, stats.nmisses));
+		return true;
+	}
+
+	if (next)
+	{
+		// Keep filling in the finer texture.  The old one stays in use until
+		// it's complete
+		uploadLayer(next_layer++);
+		if (next_layer < n) return false;
+
+		finish();
+		return true;
+	}
+
+	int want = wantedLevel(pixels);
+	if (want == base) return false;
+
+	if (want < fetched)
+	{
+		// Page in the finer levels first, in the background
+		std::lock_guard<std::mutex> lock(m);
+		if (want < fetch)
+		{
+			fetch = want;
+			cv.notify_one();
+		}
+		return false;
+	}
+
+	beginTexture(want);
+	return false;
+}
+
+//========================================================================
+
+void TextureStreamer::beginTexture(int level)
+{
+	next_base = level;
+	next_layer = 0;
+
+	int bw = std::max(1, w >> level), bh = std::max(1, h >> level);
+	int nl = nlevels - level;
+
+	// Allocate every level of every layer before any PBO is bound
+	glGenTextures(1, &next);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, next);
+	for (int l = 0; l < nl; l++)
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGBA8,
+				std::max(1, bw >> l), std::max(1, bh >> l),
+				(GLsizei) layers.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, nl - 1);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+			GL_LINEAR_MIPMAP_LINEAR);
+
+	// The renderer expects its texture to stay bound
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+}
+
+//========================================================================
+
+void TextureStreamer::uploadLayer(int i)
+{
+	int bw = std::max(1, w >> next_base), bh = std::max(1, h >> next_base);
+	int nl = nlevels - next_base;
+
+	const unsigned char* data = layers[i].data + mipBytes(w, h, next_base);
+	size_t size = chainBytes(w, h, nlevels, next_base);
+
+	// Copy into the PBO and let the driver move it to the texture
+	// asynchronously.  Orphaning the buffer first means this never waits on
+	// the previous layer's transfer
+	glBindTexture(GL_TEXTURE_2D_ARRAY, next);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+	const unsigned char* src = nullptr;
+	if (dst)
+	{
+		memcpy(dst, data, size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	else
+	{
+		// Upload straight from memory instead
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		src = data;
+	}
+
+	size_t off = 0;
+	for (int l = 0; l < nl; l++)
+	{
+		int lw = std::max(1, bw >> l), lh = std::max(1, bh >> l);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, i, lw, lh, 1,
+				GL_RGBA, GL_UNSIGNED_BYTE, src ? src + off : (void*) off);
+		off += (size_t) lw * lh * 4;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+
+	stats.bytes += size;
+}
+
+//========================================================================
+
+void TextureStreamer::finish()
+{
+	// Swap in the new texture.  The caller passes it on to the renderer,
+	// which binds it again
+	if (tex) glDeleteTextures(1, &tex);
+	tex = next;
+	base = next_base;
+	next = 0;
+
+	log(fmt::format("Textures:  {} layers at {}x{} (level {}), {:.1f} MB resident",
+			layers.size(), std::max(1, w >> base), std::max(1, h >> base), base,
+			residentBytes() / 1e6));
+}
+
+//========================================================================
+
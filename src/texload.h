@@ -0,0 +1,133 @@
+
+//========================================================================
+//
+// Texture loading:  PNGs are decoded on a thread pool, and the decoded mip
+// chains are cached on disk so that later runs can memory-map them instead
+// of decoding again.  Only the mip levels that the screen can actually show
+// are uploaded.  The coarse ones go first, and finer ones are streamed in
+// when the on-screen texel density calls for them
+//
+//========================================================================
+
+#ifndef TETRIS_TEXLOAD_H
+#define TETRIS_TEXLOAD_H
+
+#include <glad/gl.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pool.h>
+
+//========================================================================
+
+struct TexLoadStats
+{
+	// Layers read from the cache, and layers decoded from PNG
+	int nhits = 0, nmisses = 0;
+
+	// Bytes uploaded so far, over every level change
+	size_t bytes = 0;
+
+	// Wall time from start() to the first texture
+	double secs = 0;
+};
+
+// One source image, defined in texload.cpp
+struct TexLayer;
+
+//========================================================================
+
+class TextureStreamer
+{
+	public:
+
+		TextureStreamer();
+		~TextureStreamer();
+
+		// Start mapping or decoding files in the background on pool.  Every
+		// image must be the same size.  Mip chains are cached in cache_dir,
+		// or not at all if it's empty.  Resident levels are capped at budget
+		// bytes for all layers together, dropping the finest levels to fit
+		void start(const std::vector<std::string>& files,
+				const std::string& cache_dir, ThreadPool& pool, size_t budget);
+
+		// Call once a frame on the GL thread, with the number of screen
+		// pixels that one repeat of the texture covers.  At first, uploads
+		// each layer of a coarse placeholder as soon as it's prepared, and
+		// after that at most one layer per call.  Returns true when
+		// texture() has changed
+		bool update(float pixels);
+
+		// Array texture with layer i from files[i], and every mip level from
+		// level() of the source images down.  0 until the first coarse levels
+		// are in, or if loading failed
+		GLuint texture() const
+		{
+			return tex;
+		}
+
+		int level() const
+		{
+			return base;
+		}
+
+		// GPU memory of texture()
+		size_t residentBytes() const;
+
+		TexLoadStats stats;
+
+	private:
+
+		std::vector<std::string> files;
+		std::string cache_dir;
+		ThreadPool* pool = nullptr;
+		size_t budget = 0;
+		double t_start = 0;
+
+		std::vector<TexLayer> layers;
+
+		// Size and number of levels of the source images, from the first one
+		// that's prepared.  Loading stops for good if any layer fails
+		int w = 0, h = 0, nlevels = 0;
+		bool failed = false;
+
+		// Layers of the placeholder that are in so far
+		std::vector<bool> uploaded;
+		int nuploaded = 0;
+
+		// Resident texture and its finest level
+		GLuint tex = 0;
+		int base = 0;
+
+		// Texture being filled in one layer per update(), and its finest level
+		GLuint next = 0;
+		int next_base = 0, next_layer = 0;
+		GLuint pbo = 0;
+
+		// The worker thread prepares every layer, and then pages in finer
+		// levels when asked, so the GL thread doesn't stall on page faults
+		std::thread worker;
+		std::mutex m;
+		std::condition_variable cv;
+		std::atomic<int> fetched{0};
+		int fetch = 0;
+		bool stop = false;
+
+		void work();
+		bool checkLayer(int i);
+		int wantedLevel(float pixels) const;
+		void beginTexture(int level);
+		void uploadLayer(int i);
+		void finish();
+};
+
+//========================================================================
+
+#endif
+
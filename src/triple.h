@@ -0,0 +1,71 @@
+
+//========================================================================
+//
+// Lock-free triple buffer, for handing the latest of a stream of values from
+// one thread to another.  The writer and the reader each own a slot, and the
+// third one is swapped between them with a single atomic exchange, so neither
+// side ever waits on the other
+//
+//========================================================================
+
+#ifndef TETRIS_TRIPLE_H
+#define TETRIS_TRIPLE_H
+
+#include <array>
+#include <atomic>
+#include <stdint.h>
+
+//========================================================================
+
+template <typename T>
+class TripleBuffer
+{
+	public:
+
+		// Writer:  fill in back() and then publish() it.  back() is a
+		// different slot afterwards, holding whatever was in it before, so
+		// fill in all of it
+		T& back()
+		{
+			return slots[back_i];
+		}
+
+		void publish()
+		{
+			back_i = middle.exchange(back_i | FRESH, std::memory_order_acq_rel)
+					& INDEX;
+		}
+
+		// Reader:  take the newest published value, if there's one that
+		// front() hasn't seen.  Returns true if front() changed.  Values that
+		// are published faster than this is called are skipped
+		bool update()
+		{
+			if (!(middle.load(std::memory_order_relaxed) & FRESH))
+				return false;
+
+			front_i = middle.exchange(front_i, std::memory_order_acq_rel)
+					& INDEX;
+			return true;
+		}
+
+		const T& front() const
+		{
+			return slots[front_i];
+		}
+
+	private:
+
+		// The middle slot's index, and a bit set when it's newer than front()
+		static const uint8_t INDEX = 3, FRESH = 4;
+
+		std::array<T, 3> slots;
+
+		uint8_t back_i = 0, front_i = 1;
+		std::atomic<uint8_t> middle{2};
+};
+
+//========================================================================
+
+#endif
+